@@ -0,0 +1,87 @@
+#include "bench.h"
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <time.h>
+
+void Bench::report(const QString &benchmark, const QJsonObject &results)
+{
+    QJsonObject line = results;
+    line["benchmark"] = benchmark;
+    const QByteArray json = QJsonDocument(line).toJson(QJsonDocument::Compact);
+    std::fprintf(stdout, "%s\n", json.constData());
+    std::fflush(stdout);
+}
+
+qint64 Bench::rssKb()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+    {
+        return -1;
+    }
+    for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine())
+    {
+        if (line.startsWith("VmRSS:"))
+        {
+            return line.mid(6).simplified().split(' ').value(0).toLongLong();
+        }
+    }
+    return -1;
+}
+
+double Bench::percentile(QVector<double> samples, double p)
+{
+    if (samples.isEmpty())
+    {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    const int rank = std::min(samples.size() - 1, std::max(0, int(std::ceil(p * samples.size())) - 1));
+    return samples[rank];
+}
+
+QJsonObject Bench::distribution(const QString &prefix, const QVector<double> &samples)
+{
+    QJsonObject results;
+    results[prefix + "_p50"] = percentile(samples, 0.5);
+    results[prefix + "_p99"] = percentile(samples, 0.99);
+    results[prefix + "_max"] = percentile(samples, 1.0);
+    return results;
+}
+
+qint64 Bench::threadCpuNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return qint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+bool Bench::waitUntil(const std::function<bool()> &done, int timeout_ms)
+{
+    if (done())
+    {
+        return true;
+    }
+    QElapsedTimer clock;
+    clock.start();
+    QEventLoop loop;
+    QTimer poll;
+    QObject::connect(&poll, &QTimer::timeout, &loop, [&]() {
+        if (done() || clock.elapsed() >= timeout_ms)
+        {
+            loop.quit();
+        }
+    });
+    poll.start(1);
+    loop.exec();
+    return done();
+}
@@ -0,0 +1,58 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+// Helpers shared by the textedit_bench benchmarks. Each benchmark reports its results as
+// one JSON object per line on stdout, so runs can be compared between releases.
+namespace Bench
+{
+    void report(const QString& benchmark, const QJsonObject& results);
+
+    // Resident set size of this process, from /proc.
+    qint64 rssKb();
+
+    // The p-th percentile (0..1) of samples, nearest rank.
+    double percentile(QVector<double> samples, double p);
+
+    // prefix_p50, prefix_p99 and prefix_max of samples.
+    QJsonObject distribution(const QString& prefix, const QVector<double>& samples);
+
+    // CPU time the calling thread has used.
+    qint64 threadCpuNs();
+
+    // Runs the event loop until done() holds or timeout_ms passes; returns done().
+    bool waitUntil(const std::function<bool()>& done, int timeout_ms);
+
+    void hubSessions(int sessions, int clients, int rounds, const QString& transport);
+
+    void broadcastFanout(int readers, int ops, int frame_bytes);
+
+    void relayFanout(const QList<int>& client_counts, int ops, const QString& transport);
+
+    void serialize(int iterations);
+
+    void deserialize(int iterations);
+
+    // The rest need a QApplication; it runs offscreen.
+    void contentsChange(int iterations);
+
+    void htmlApply(int iterations);
+
+    void snapshot();
+
+    void load();
+
+    // Kills a host mid-replay; the host is this program again, in serveSession().
+    void failover(int clients, int rate, int kill_after_ms, const QString& transport);
+
+    // Hosts session until killed; returns the exit code if it cannot.
+    int serveSession(const QString& session, const QString& transport);
+}
+
+#endif // BENCH_H
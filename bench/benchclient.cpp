@@ -0,0 +1,77 @@
+#include "benchclient.h"
+
+BenchClient::BenchClient(Transport *transport, const QString &server, const QString &session, QObject *parent) :
+    QObject(parent),
+    m_socket(transport->createConnection(this)),
+    m_server(server),
+    m_session(session)
+{
+    connect(m_socket, &Connection::connected, this, &BenchClient::connected);
+    connect(m_socket, &Connection::readyRead, this, &BenchClient::readyRead);
+}
+
+void BenchClient::connectToServer()
+{
+    m_socket->connectToServer(m_server);
+}
+
+void BenchClient::disconnectFromServer()
+{
+    m_socket->disconnectFromServer();
+}
+
+bool BenchClient::joined() const
+{
+    return m_joined;
+}
+
+void BenchClient::sendOp(quint64 id)
+{
+    Message message;
+    message.type = kContentChangedWithPlain;
+    message.content.added = QString::number(id);
+    m_socket->device()->write(Framing::pack(m_serializer.Process(message)));
+    m_socket->flush();
+}
+
+void BenchClient::connected()
+{
+    Message hello;
+    hello.type = kHello;
+    hello.hello.session = m_session;
+    m_socket->device()->write(Framing::pack(m_serializer.Process(hello)));
+    m_socket->flush();
+}
+
+// Acks and everything but joining and plain inserts are of no interest here.
+void BenchClient::readyRead()
+{
+    m_reader.append(m_socket->device()->readAll());
+    QByteArray payload;
+    while (m_reader.next(payload))
+    {
+        Message message;
+        if (payload.isEmpty() || !m_deserializer.ProcessOne(payload, message))
+        {
+            continue;
+        }
+        if (message.type == kInit)
+        {
+            m_joined = true;
+        } else if (message.type == kSnapshotRequest)
+        {
+            // The first joiner of a hub session seeds it, with an empty document.
+            Message init;
+            init.type = kInit;
+            Message answer;
+            answer.type = kSnapshot;
+            answer.snapshot.payloads.push_back(m_serializer.Process(init));
+            m_socket->device()->write(Framing::pack(m_serializer.Process(answer)));
+            m_socket->flush();
+            m_joined = true;
+        } else if (message.type == kContentChangedWithPlain)
+        {
+            emit received(message.content.added.toULongLong());
+        }
+    }
+}
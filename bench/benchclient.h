@@ -0,0 +1,46 @@
+#ifndef BENCHCLIENT_H
+#define BENCHCLIENT_H
+
+#include <QObject>
+
+#include "serialization.h"
+#include "framing.h"
+#include "transport.h"
+
+// A synthetic peer speaking the session protocol without a document: it joins a session,
+// sends plain inserts whose text is an op id and reports the ids of the ones it receives.
+class BenchClient : public QObject
+{
+    Q_OBJECT
+public:
+    // Connects through transport, which has to outlive the client.
+    BenchClient(Transport* transport, const QString& server, const QString& session, QObject* parent = nullptr);
+
+    void connectToServer();
+
+    void disconnectFromServer();
+
+    // Set once the host has sent the document, or asked for it.
+    bool joined() const;
+
+    void sendOp(quint64 id);
+
+signals:
+    void received(quint64 id);
+
+private slots:
+    void connected();
+
+    void readyRead();
+
+private:
+    Connection* m_socket;
+    QString m_server;
+    QString m_session;
+    FrameReader m_reader;
+    JsonSerializer m_serializer;
+    JsonDeserializer m_deserializer;
+    bool m_joined = false;
+};
+
+#endif // BENCHCLIENT_H
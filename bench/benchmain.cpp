@@ -0,0 +1,110 @@
+#include "bench.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+
+#include <cstdio>
+
+int main(int argc, char *argv[])
+{
+    // The editor benchmarks need widgets but never show them.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication a(argc, argv);
+    QCoreApplication::setApplicationName("textedit_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Collaboration hot path benchmarks; prints one JSON object per result.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("benchmark", "Benchmarks to run (default: all): serialize, deserialize, contents_change, html_apply, snapshot, load, hub_sessions, broadcast_fanout, relay_fanout, failover.");
+    QCommandLineOption iterations_option("iterations", "Iterations for serialize, deserialize, contents_change and html_apply.", "count", "10000");
+    parser.addOption(iterations_option);
+    QCommandLineOption sessions_option("sessions", "Sessions for hub_sessions.", "count", "500");
+    parser.addOption(sessions_option);
+    QCommandLineOption clients_option("clients", "Clients per session for hub_sessions.", "count", "5");
+    parser.addOption(clients_option);
+    QCommandLineOption rounds_option("rounds", "Ops sent per session.", "count", "20");
+    parser.addOption(rounds_option);
+    QCommandLineOption transport_option("transport", "Transport for hub_sessions, relay_fanout and failover: local, shm or tcp[:host[:port]] over loopback.", "transport", "local");
+    parser.addOption(transport_option);
+    QCommandLineOption readers_option("readers", "Readers for broadcast_fanout.", "count", "50");
+    parser.addOption(readers_option);
+    QCommandLineOption ops_option("ops", "Ops published by broadcast_fanout.", "count", "10000");
+    parser.addOption(ops_option);
+    QCommandLineOption frame_bytes_option("frame-bytes", "Frame size for broadcast_fanout.", "bytes", "256");
+    parser.addOption(frame_bytes_option);
+    QCommandLineOption relay_clients_option("relay-clients", "Comma-separated session sizes for relay_fanout.", "counts", "10,100,500");
+    parser.addOption(relay_clients_option);
+    QCommandLineOption relay_ops_option("relay-ops", "Ops relayed per session size by relay_fanout.", "count", "1000");
+    parser.addOption(relay_ops_option);
+    QCommandLineOption failover_clients_option("failover-clients", "Editors in the session failover stops the host of.", "count", "5");
+    parser.addOption(failover_clients_option);
+    QCommandLineOption failover_rate_option("failover-rate", "Characters per second each failover editor types.", "rate", "10");
+    parser.addOption(failover_rate_option);
+    QCommandLineOption kill_after_option("kill-after", "Milliseconds failover types before killing the host, and after.", "ms", "2000");
+    parser.addOption(kill_after_option);
+    QCommandLineOption serve_session_option("serve-session", "Hosts a session until killed instead; failover runs the host this way.", "name");
+    serve_session_option.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOption(serve_session_option);
+    parser.process(a);
+
+    if (parser.isSet(serve_session_option))
+    {
+        return Bench::serveSession(parser.value(serve_session_option), parser.value(transport_option));
+    }
+
+    QStringList benchmarks = parser.positionalArguments();
+    if (benchmarks.isEmpty())
+    {
+        benchmarks << "serialize" << "deserialize" << "contents_change" << "html_apply" << "snapshot" << "load"
+                   << "hub_sessions" << "broadcast_fanout" << "relay_fanout" << "failover";
+    }
+    const int iterations = parser.value(iterations_option).toInt();
+    for (auto& benchmark : benchmarks)
+    {
+        if (benchmark == "serialize")
+        {
+            Bench::serialize(iterations);
+        } else if (benchmark == "deserialize")
+        {
+            Bench::deserialize(iterations);
+        } else if (benchmark == "contents_change")
+        {
+            Bench::contentsChange(iterations);
+        } else if (benchmark == "html_apply")
+        {
+            Bench::htmlApply(iterations);
+        } else if (benchmark == "snapshot")
+        {
+            Bench::snapshot();
+        } else if (benchmark == "load")
+        {
+            Bench::load();
+        } else if (benchmark == "hub_sessions")
+        {
+            Bench::hubSessions(parser.value(sessions_option).toInt(), parser.value(clients_option).toInt(), parser.value(rounds_option).toInt(), parser.value(transport_option));
+        } else if (benchmark == "broadcast_fanout")
+        {
+            Bench::broadcastFanout(parser.value(readers_option).toInt(), parser.value(ops_option).toInt(), parser.value(frame_bytes_option).toInt());
+        } else if (benchmark == "relay_fanout")
+        {
+            QList<int> client_counts;
+            for (auto& count : parser.value(relay_clients_option).split(',', Qt::SkipEmptyParts))
+            {
+                client_counts.push_back(count.toInt());
+            }
+            Bench::relayFanout(client_counts, parser.value(relay_ops_option).toInt(), parser.value(transport_option));
+        } else if (benchmark == "failover")
+        {
+            Bench::failover(parser.value(failover_clients_option).toInt(), parser.value(failover_rate_option).toInt(), parser.value(kill_after_option).toInt(), parser.value(transport_option));
+        } else
+        {
+            std::fprintf(stderr, "unknown benchmark %s\n", qPrintable(benchmark));
+            return 1;
+        }
+    }
+    return 0;
+}
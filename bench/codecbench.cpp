@@ -0,0 +1,142 @@
+#include "bench.h"
+#include "serialization.h"
+#include "framing.h"
+#include "richfragment.h"
+
+#include <QElapsedTimer>
+#include <QPair>
+#include <QScopedPointer>
+#include <QTextBlockFormat>
+#include <QTextCharFormat>
+#include <QTextCursor>
+#include <QTextDocument>
+
+namespace
+{
+    // Ops as the editor sends them: a keystroke, a paste, a formatted insert and a style change.
+    QList<QPair<QString, Message>> sampleMessages()
+    {
+        QList<QPair<QString, Message>> samples;
+
+        Message keystroke;
+        keystroke.type = kContentChangedWithPlain;
+        keystroke.content.position = 4096;
+        keystroke.content.added = "x";
+        samples << qMakePair(QString("keystroke"), keystroke);
+
+        Message paste = keystroke;
+        paste.content.added = QString("The quick brown fox jumps over the lazy dog. ").repeated(90);
+        samples << qMakePair(QString("paste"), paste);
+
+        QTextDocument document;
+        QTextCursor cursor(&document);
+        QTextCharFormat bold;
+        bold.setFontWeight(QFont::Bold);
+        QTextCharFormat italic;
+        italic.setFontItalic(true);
+        cursor.insertText("Some ");
+        cursor.insertText("bold", bold);
+        cursor.insertText(" and ");
+        cursor.insertText("italic", italic);
+        cursor.insertText(" text");
+        FormatTable formats;
+        Message rich = keystroke;
+        rich.type = kContentChangedWithFragment;
+        rich.content.added.clear();
+        rich.content.fragment = RichFragment::encode(&document, 0, document.characterCount() - 1, formats);
+        samples << qMakePair(QString("rich_insert"), rich);
+
+        Message style;
+        style.type = kStyleChanged;
+        style.style.position = 4096;
+        style.style.length = 80;
+        QTextBlockFormat block_format;
+        block_format.setAlignment(Qt::AlignHCenter);
+        block_format.setIndent(1);
+        style.style.block_format = RichFragment::saveFormat(block_format);
+        samples << qMakePair(QString("style"), style);
+        return samples;
+    }
+
+    ISerializer* serializerFor(const QString& codec)
+    {
+        if (codec == "binary")
+        {
+            return new BinarySerializer;
+        }
+        return new JsonSerializer;
+    }
+
+    IDeserializer* deserializerFor(const QString& codec)
+    {
+        if (codec == "binary")
+        {
+            return new BinaryDeserializer;
+        }
+        return new JsonDeserializer;
+    }
+
+    const QStringList kCodecs = QStringList() << "json" << "binary";
+}
+
+void Bench::serialize(int iterations)
+{
+    const QList<QPair<QString, Message>> samples = sampleMessages();
+    for (auto& codec : kCodecs)
+    {
+        QScopedPointer<ISerializer> serializer(serializerFor(codec));
+        for (auto& sample : samples)
+        {
+            QVector<double> samples_ns;
+            samples_ns.reserve(iterations);
+            int bytes = 0;
+            for (int i = 0; i < iterations; ++i)
+            {
+                QElapsedTimer timer;
+                timer.start();
+                bytes = serializer->Process(sample.second).size();
+                samples_ns.push_back(timer.nsecsElapsed());
+            }
+            QJsonObject results = distribution("ns", samples_ns);
+            results["codec"] = codec;
+            results["message"] = sample.first;
+            results["bytes"] = bytes;
+            results["iterations"] = iterations;
+            report("serialize", results);
+        }
+    }
+}
+
+// What a reader does with one socket read: decode every frame of a buffer holding many.
+void Bench::deserialize(int iterations)
+{
+    const QList<QPair<QString, Message>> samples = sampleMessages();
+    for (auto& codec : kCodecs)
+    {
+        QScopedPointer<ISerializer> serializer(serializerFor(codec));
+        QScopedPointer<IDeserializer> deserializer(deserializerFor(codec));
+        QByteArray frames;
+        for (int i = 0; i < iterations; ++i)
+        {
+            frames.append(Framing::pack(serializer->Process(samples[i % samples.size()].second)));
+        }
+        QVector<double> samples_ns;
+        int decoded = 0;
+        for (int run = 0; run < 5; ++run)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            decoded = deserializer->Process(frames).size();
+            samples_ns.push_back(timer.nsecsElapsed());
+        }
+        const double best_ns = percentile(samples_ns, 0);
+        QJsonObject results;
+        results["codec"] = codec;
+        results["frames"] = iterations;
+        results["decoded"] = decoded;
+        results["bytes"] = frames.size();
+        results["ns_per_frame"] = iterations > 0 ? best_ns / iterations : 0;
+        results["mb_per_s"] = best_ns > 0 ? frames.size() / best_ns * 1000.0 : 0;
+        report("deserialize", results);
+    }
+}
@@ -0,0 +1,220 @@
+#include "bench.h"
+#include "localserver.h"
+#include "textedit.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSignalBlocker>
+#include <QTemporaryDir>
+#include <QTextCursor>
+#include <QTextDocumentFragment>
+
+namespace
+{
+    struct DocumentSize
+    {
+        const char* name;
+        int paragraphs;
+    };
+
+    const DocumentSize kDocumentSizes[] = {{"small", 100}, {"medium", 5000}, {"huge", 100000}};
+
+    // Paragraphs of mixed formatting, with a heading every fifty and a list every hundred.
+    QString documentHtml(int paragraphs)
+    {
+        QString html = "<html><body>";
+        for (int i = 0; i < paragraphs; ++i)
+        {
+            if (i % 50 == 0)
+            {
+                html += QString("<h2>Section %1</h2>").arg(i / 50);
+            }
+            if (i % 100 == 99)
+            {
+                html += "<ul><li>first item</li><li>second <b>item</b></li></ul>";
+            }
+            html += QString("<p>Paragraph %1 has <b>bold</b>, <i>italic</i> and <span style=\"color:#aa0000;\">coloured</span> "
+                            "words among the plain ones that make up most of a document.</p>").arg(i);
+        }
+        return html + "</body></html>";
+    }
+}
+
+// Hosts a session on a TextEdit that is never shown and times LocalServer's own steps;
+// a friend of LocalServer. Ops it sends go to a host with no peers.
+class EditorBench
+{
+public:
+    EditorBench() :
+        m_server(m_textEdit, QString("textedit-bench-editor-%1").arg(QCoreApplication::applicationPid()), new JsonSerializer, new JsonDeserializer, Transport::create("local"))
+    {
+        QObject::connect(m_server.m_worker.data(), &NetworkWorker::hosting, &m_textEdit, [this]() { m_hosting = true; });
+        Bench::waitUntil([this]() { return m_hosting; }, 5000);
+    }
+
+    // Time from a change QTextDocument reports to the op being handed to the worker.
+    void contentsChange(int iterations, bool rich)
+    {
+        setDocument(documentHtml(1000));
+        QTextDocument* document = m_textEdit.document();
+        QTextCharFormat bold;
+        bold.setFontWeight(QFont::Bold);
+        QTextCursor cursor(document);
+        QVector<double> samples_ns;
+        samples_ns.reserve(iterations);
+        for (int i = 0; i < iterations; ++i)
+        {
+            const int position = 1 + int(qint64(i) * 7919 % (document->characterCount() - 2));
+            {
+                const QSignalBlocker blocker(&m_textEdit);
+                cursor.setPosition(position);
+                if (rich)
+                {
+                    cursor.insertText("xy", bold);
+                } else
+                {
+                    cursor.insertText("x");
+                }
+            }
+            QElapsedTimer timer;
+            timer.start();
+            m_server.contentsChange(position, 0, rich ? 2 : 1);
+            m_server.m_batcher.flush();
+            samples_ns.push_back(timer.nsecsElapsed());
+        }
+        QJsonObject results = Bench::distribution("ns", samples_ns);
+        results["edit"] = rich ? "rich" : "plain";
+        results["iterations"] = iterations;
+        Bench::report("contents_change", results);
+    }
+
+    // Ops from peers that still send kContentChangedWithHtml.
+    void htmlApply(int iterations)
+    {
+        setDocument(documentHtml(1000));
+        QTextDocument* document = m_textEdit.document();
+        QTextCursor source(document);
+        source.setPosition(100);
+        source.setPosition(400, QTextCursor::KeepAnchor);
+        ContentChangedMessage message;
+        message.added = QTextDocumentFragment(source).toHtml();
+
+        QVector<double> samples_ns;
+        samples_ns.reserve(iterations);
+        for (int i = 0; i < iterations; ++i)
+        {
+            message.position = 1 + int(qint64(i) * 7919 % (document->characterCount() - 2));
+            QElapsedTimer timer;
+            timer.start();
+            m_server.changeContentWithHtml(message);
+            samples_ns.push_back(timer.nsecsElapsed());
+        }
+        QJsonObject results = Bench::distribution("ns", samples_ns);
+        results["html_bytes"] = message.added.toUtf8().size();
+        results["iterations"] = iterations;
+        Bench::report("html_apply", results);
+    }
+
+    // What a joiner costs the host: the document cut into chunks on the GUI thread, then
+    // encoded for the wire, which the worker does when the snapshot is handed over.
+    void snapshot()
+    {
+        JsonSerializer serializer;
+        for (auto& size : kDocumentSizes)
+        {
+            setDocument(documentHtml(size.paragraphs));
+            QElapsedTimer timer;
+            timer.start();
+            const QList<Message> snapshot = m_server.takeSnapshot();
+            const qint64 take_ns = timer.nsecsElapsed();
+            timer.restart();
+            qint64 bytes = 0;
+            for (auto& message : snapshot)
+            {
+                bytes += Framing::pack(serializer.Process(message)).size();
+            }
+            const qint64 encode_ns = timer.nsecsElapsed();
+
+            QJsonObject results;
+            results["document"] = size.name;
+            results["characters"] = m_textEdit.document()->characterCount();
+            results["messages"] = snapshot.size();
+            results["bytes"] = bytes;
+            results["take_ms"] = take_ns / 1e6;
+            results["encode_ms"] = encode_ns / 1e6;
+            Bench::report("snapshot", results);
+        }
+    }
+
+    void load()
+    {
+        QTemporaryDir directory;
+        for (auto& size : kDocumentSizes)
+        {
+            const QString path = directory.filePath(QString("%1.html").arg(size.name));
+            QFile file(path);
+            if (!file.open(QFile::WriteOnly))
+            {
+                continue;
+            }
+            file.write(documentHtml(size.paragraphs).toUtf8());
+            file.close();
+
+            setDocument(QString());
+            const qint64 rss_before = Bench::rssKb();
+            QElapsedTimer timer;
+            timer.start();
+            bool loaded = false;
+            {
+                const QSignalBlocker blocker(&m_textEdit);
+                loaded = m_textEdit.load(path);
+            }
+            const qint64 load_ns = timer.nsecsElapsed();
+
+            QJsonObject results;
+            results["document"] = size.name;
+            results["loaded"] = loaded;
+            results["file_bytes"] = QFileInfo(path).size();
+            results["characters"] = m_textEdit.document()->characterCount();
+            results["load_ms"] = load_ns / 1e6;
+            results["rss_kb_growth"] = Bench::rssKb() - rss_before;
+            Bench::report("load", results);
+        }
+    }
+
+private:
+    // Without the edit reaching the session as one huge op.
+    void setDocument(const QString& html)
+    {
+        const QSignalBlocker blocker(&m_textEdit);
+        m_textEdit.loadExternalData(html);
+    }
+
+    TextEdit m_textEdit;
+    LocalServer m_server;
+    bool m_hosting = false;
+};
+
+void Bench::contentsChange(int iterations)
+{
+    EditorBench bench;
+    bench.contentsChange(iterations, false);
+    bench.contentsChange(iterations, true);
+}
+
+void Bench::htmlApply(int iterations)
+{
+    EditorBench().htmlApply(iterations);
+}
+
+void Bench::snapshot()
+{
+    EditorBench().snapshot();
+}
+
+void Bench::load()
+{
+    EditorBench().load();
+}
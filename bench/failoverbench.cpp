@@ -0,0 +1,243 @@
+#include "bench.h"
+#include "localserver.h"
+#include "networkworker.h"
+#include "textedit.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QScopedPointer>
+#include <QTextCursor>
+#include <QTimer>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+    bool accepting(Transport* transport, const QString& session)
+    {
+        QScopedPointer<Connection> probe(transport->createConnection(nullptr));
+        probe->connectToServer(session);
+        const bool connected = probe->waitForConnected(100);
+        probe->abort();
+        return connected;
+    }
+}
+
+// An editor that is never shown, typing a letter at a random place on every tick; a
+// friend of LocalServer for its worker's counters.
+class FailoverPeer
+{
+public:
+    FailoverPeer(const QString& session, const QString& transport, quint32 seed, const QElapsedTimer& clock) :
+        m_server(m_textEdit, session, new JsonSerializer, new JsonDeserializer, Transport::create(transport)),
+        m_random(seed),
+        m_clock(clock)
+    {
+        m_server.setBatchWindow(0);
+        QObject::connect(m_textEdit.document(), &QTextDocument::contentsChange, &m_textEdit, [this]() {
+            if (!m_typing)
+            {
+                m_lastRemoteMs = m_clock.elapsed();
+            }
+        });
+        QObject::connect(&m_typer, &QTimer::timeout, &m_textEdit, [this]() { type(); });
+    }
+
+    // A joiner is sent the document, or asked for it when the session is new.
+    bool joined() const
+    {
+        const Metrics& metrics = m_server.m_worker->metrics();
+        return metrics.receivedCount(kInit) > 0 || metrics.receivedCount(kSnapshotRequest) > 0;
+    }
+
+    bool failedOver() const
+    {
+        const Metrics& metrics = m_server.m_worker->metrics();
+        return metrics.failoverCount(Metrics::kPromoted) > 0 || metrics.failoverCount(Metrics::kReconnected) > 0;
+    }
+
+    bool gaveUp() const
+    {
+        return m_server.m_worker->metrics().failoverCount(Metrics::kGaveUp) > 0;
+    }
+
+    bool promoted() const
+    {
+        return m_server.m_worker->metrics().failoverCount(Metrics::kPromoted) > 0;
+    }
+
+    // When a peer's op last changed the document, on the bench clock.
+    qint64 lastRemoteMs() const
+    {
+        return m_lastRemoteMs;
+    }
+
+    void startTyping(int rate)
+    {
+        m_typer.start(std::max(1, 1000 / std::max(1, rate)));
+    }
+
+    void stopTyping()
+    {
+        m_typer.stop();
+    }
+
+    QString text()
+    {
+        return m_textEdit.document()->toPlainText();
+    }
+
+private:
+    void type()
+    {
+        QTextDocument* document = m_textEdit.document();
+        QTextCursor cursor(document);
+        cursor.setPosition(int(m_random.bounded(quint32(document->characterCount()))));
+        m_typing = true;
+        cursor.insertText(QString(QChar('a' + int(m_random.bounded(26)))));
+        m_typing = false;
+    }
+
+    TextEdit m_textEdit;
+    LocalServer m_server;
+    QRandomGenerator m_random;
+    const QElapsedTimer& m_clock;
+    QTimer m_typer;
+    bool m_typing = false;
+    qint64 m_lastRemoteMs = -1;
+};
+
+int Bench::serveSession(const QString& session, const QString& transport)
+{
+    NetworkWorker host(session, new JsonSerializer, new JsonDeserializer, Transport::create(transport));
+    if (!host.startHub())
+    {
+        return 1;
+    }
+    return QCoreApplication::exec();
+}
+
+// A host in a child process and editors here typing into its session; the host is
+// killed mid-replay, so nobody is handed the session. Measures how long until every
+// editor is hosting or reconnected and edits reach it again, and whether the replicas
+// agree once typing stops.
+void Bench::failover(int clients, int rate, int kill_after_ms, const QString& transport)
+{
+    const QString session = QString("textedit-bench-failover-%1").arg(QCoreApplication::applicationPid());
+    QScopedPointer<Transport> probe_transport(Transport::create(transport));
+    QProcess host;
+    host.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    host.start(QCoreApplication::applicationFilePath(), QStringList() << "--serve-session" << session << "--transport" << transport);
+    if (!host.waitForStarted() || !Bench::waitUntil([&]() { return accepting(probe_transport.data(), session); }, 10000))
+    {
+        std::fprintf(stderr, "failover: the host did not start\n");
+        host.kill();
+        host.waitForFinished();
+        return;
+    }
+
+    QElapsedTimer clock;
+    clock.start();
+    QList<FailoverPeer*> peers;
+    for (int i = 0; i < clients; ++i)
+    {
+        peers.push_back(new FailoverPeer(session, transport, quint32(i + 1), clock));
+    }
+    int joined = 0;
+    Bench::waitUntil([&]() {
+        joined = 0;
+        for (auto peer : peers)
+        {
+            joined += peer->joined() ? 1 : 0;
+        }
+        return joined == peers.size();
+    }, 30000);
+
+    for (auto peer : peers)
+    {
+        peer->startTyping(rate);
+    }
+    Bench::waitUntil([]() { return false; }, kill_after_ms);
+
+    const qint64 stopped_ms = clock.elapsed();
+    host.kill();
+    QVector<qint64> failover_ms(peers.size(), -1);
+    QVector<qint64> flowing_ms(peers.size(), -1);
+    Bench::waitUntil([&]() {
+        bool done = true;
+        for (int i = 0; i < peers.size(); ++i)
+        {
+            if (failover_ms[i] < 0 && peers[i]->failedOver())
+            {
+                failover_ms[i] = clock.elapsed() - stopped_ms;
+            }
+            // Edits flow again once one made after the failover reaches this editor.
+            if (failover_ms[i] >= 0 && flowing_ms[i] < 0 && peers[i]->lastRemoteMs() > stopped_ms + failover_ms[i])
+            {
+                flowing_ms[i] = peers[i]->lastRemoteMs() - stopped_ms;
+            }
+            done = done && (flowing_ms[i] >= 0 || peers[i]->gaveUp());
+        }
+        return done;
+    }, 15000);
+    host.waitForFinished();
+
+    // Typing goes on over the new host for as long as it did before the old one died.
+    Bench::waitUntil([]() { return false; }, kill_after_ms);
+    for (auto peer : peers)
+    {
+        peer->stopTyping();
+    }
+    auto divergent = [&]() {
+        QHash<QString, int> counts;
+        int majority = 0;
+        for (auto peer : peers)
+        {
+            majority = std::max(majority, ++counts[peer->text()]);
+        }
+        return peers.size() - majority;
+    };
+    const bool converged = Bench::waitUntil([&]() { return divergent() == 0; }, 5000);
+
+    QVector<double> failover_samples;
+    QVector<double> flowing_samples;
+    int promoted = 0;
+    int gave_up = 0;
+    for (int i = 0; i < peers.size(); ++i)
+    {
+        if (failover_ms[i] >= 0)
+        {
+            failover_samples.push_back(failover_ms[i]);
+        }
+        if (flowing_ms[i] >= 0)
+        {
+            flowing_samples.push_back(flowing_ms[i]);
+        }
+        promoted += peers[i]->promoted() ? 1 : 0;
+        gave_up += peers[i]->gaveUp() ? 1 : 0;
+    }
+
+    QJsonObject results = Bench::distribution("failover_ms", failover_samples);
+    const QJsonObject flowing_results = Bench::distribution("edits_flow_ms", flowing_samples);
+    for (auto it = flowing_results.begin(); it != flowing_results.end(); ++it)
+    {
+        results[it.key()] = it.value();
+    }
+    results["transport"] = transport;
+    results["clients"] = clients;
+    results["joined"] = joined;
+    results["rate"] = rate;
+    results["failed_over"] = failover_samples.size();
+    results["promoted"] = promoted;
+    results["gave_up"] = gave_up;
+    results["flowing"] = flowing_samples.size();
+    results["converged"] = converged;
+    results["divergent_replicas"] = divergent();
+    results["characters"] = peers.isEmpty() ? 0 : peers.first()->text().size();
+    Bench::report("failover", results);
+    qDeleteAll(peers);
+}
@@ -0,0 +1,144 @@
+#include "bench.h"
+#include "sharedring.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QList>
+
+namespace
+{
+    QJsonObject costs(const QVector<double>& publish_ns, qint64 total_ms, int ops)
+    {
+        QJsonObject results;
+        results["host_ns_per_op_p50"] = Bench::percentile(publish_ns, 0.5);
+        results["host_ns_per_op_p99"] = Bench::percentile(publish_ns, 0.99);
+        results["delivery_ms"] = total_ms;
+        results["ops_per_s"] = total_ms > 0 ? ops * 1000.0 / total_ms : 0;
+        return results;
+    }
+
+    // One write per reader per op, as a host relaying over local sockets does.
+    QJsonObject socketFanout(int readers, int ops, const QByteArray& frame)
+    {
+        QLocalServer server;
+        const QString name = QString("textedit-bench-fanout-%1").arg(QCoreApplication::applicationPid());
+        QLocalServer::removeServer(name);
+        if (!server.listen(name))
+        {
+            return QJsonObject();
+        }
+        QList<QLocalSocket*> clients;
+        QList<QLocalSocket*> peers;
+        qint64 received = 0;
+        for (int i = 0; i < readers; ++i)
+        {
+            QLocalSocket* client = new QLocalSocket(&server);
+            QObject::connect(client, &QLocalSocket::readyRead, [client, &received]() { received += client->readAll().size(); });
+            client->connectToServer(name);
+            clients.push_back(client);
+        }
+        Bench::waitUntil([&]() {
+            while (server.hasPendingConnections())
+            {
+                peers.push_back(server.nextPendingConnection());
+            }
+            return peers.size() == readers;
+        }, 10000);
+
+        QVector<double> publish_ns;
+        QElapsedTimer total;
+        total.start();
+        for (int op = 0; op < ops; ++op)
+        {
+            QElapsedTimer publish;
+            publish.start();
+            for (auto peer : peers)
+            {
+                peer->write(frame);
+                peer->flush();
+            }
+            publish_ns.push_back(publish.nsecsElapsed());
+        }
+        const qint64 expected = qint64(ops) * frame.size() * readers;
+        Bench::waitUntil([&]() { return received >= expected; }, 60000);
+        QJsonObject results = costs(publish_ns, total.elapsed(), ops);
+        results["delivered_fraction"] = expected > 0 ? double(received) / expected : 0;
+        return results;
+    }
+
+    // One publish per op, read by every reader out of shared memory.
+    QJsonObject ringFanout(int readers, int ops, const QByteArray& frame)
+    {
+        const QString key = QString("textedit-bench-ring-%1").arg(QCoreApplication::applicationPid());
+        SharedRingWriter writer;
+        if (!writer.create(key))
+        {
+            return QJsonObject();
+        }
+        QList<SharedRingReader*> ring_readers;
+        qint64 received = 0;
+        int overruns = 0;
+        for (int i = 0; i < readers; ++i)
+        {
+            SharedRingReader* reader = new SharedRingReader;
+            if (!reader->attach(key, writer.position()))
+            {
+                delete reader;
+                continue;
+            }
+            QObject::connect(reader, &BroadcastReader::readyRead, reader, [reader, &received, &overruns]() {
+                QByteArray frame;
+                quint32 origin = 0;
+                BroadcastReader::Result result;
+                while ((result = reader->next(frame, origin)) == BroadcastReader::kFrame)
+                {
+                    received += frame.size();
+                }
+                overruns += result == BroadcastReader::kOverrun ? 1 : 0;
+            });
+            ring_readers.push_back(reader);
+        }
+
+        QVector<double> publish_ns;
+        QElapsedTimer total;
+        total.start();
+        for (int op = 0; op < ops; ++op)
+        {
+            QElapsedTimer publish;
+            publish.start();
+            writer.publish(frame, 0);
+            publish_ns.push_back(publish.nsecsElapsed());
+        }
+        const qint64 expected = qint64(ops) * frame.size() * ring_readers.size();
+        Bench::waitUntil([&]() { return received >= expected || overruns > 0; }, 60000);
+        QJsonObject results = costs(publish_ns, total.elapsed(), ops);
+        results["delivered_fraction"] = expected > 0 ? double(received) / expected : 0;
+        results["overruns"] = overruns;
+        qDeleteAll(ring_readers);
+        return results;
+    }
+}
+
+// Host-side cost of handing one op to every reader over local sockets and over the
+// shared-memory ring. Readers live in this process; with the ring each also has its
+// futex watcher thread, as it would in a peer.
+void Bench::broadcastFanout(int readers, int ops, int frame_bytes)
+{
+    const QByteArray frame(frame_bytes, 'x');
+
+    QJsonObject results = socketFanout(readers, ops, frame);
+    results["transport"] = "local";
+    results["readers"] = readers;
+    results["ops"] = ops;
+    results["frame_bytes"] = frame_bytes;
+    report("broadcast_fanout", results);
+
+    results = ringFanout(readers, ops, frame);
+    results["transport"] = "shm";
+    results["readers"] = readers;
+    results["ops"] = ops;
+    results["frame_bytes"] = frame_bytes;
+    report("broadcast_fanout", results);
+}
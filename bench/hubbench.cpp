@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "benchclient.h"
+#include "hub.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+
+// One Hub with sessions x clients synthetic peers in this process. Each round, one peer
+// of every session sends an op; latency runs from its send to each other peer's receipt.
+// The RSS growth covers the clients' sockets as well as the hub's sessions.
+void Bench::hubSessions(int sessions, int clients, int rounds, const QString &transport)
+{
+    QScopedPointer<Transport> client_transport(Transport::create(transport));
+    if (client_transport.isNull())
+    {
+        qWarning() << "unknown transport" << transport;
+        return;
+    }
+    Hub::raiseFileLimit();
+    const QString server = QString("textedit-bench-hub-%1").arg(QCoreApplication::applicationPid());
+    Hub hub(server, "json", transport, 0);
+    if (!hub.start())
+    {
+        return;
+    }
+
+    const qint64 rss_before = rssKb();
+    QElapsedTimer clock;
+    clock.start();
+
+    QList<BenchClient*> peers;
+    QHash<quint64, qint64> sent_at;
+    QVector<double> latencies_us;
+    int joined = 0;
+    for (int session = 0; session < sessions; ++session)
+    {
+        for (int client = 0; client < clients; ++client)
+        {
+            BenchClient* peer = new BenchClient(client_transport.data(), server, QString("session-%1").arg(session), &hub);
+            QObject::connect(peer, &BenchClient::received, [&](quint64 id) {
+                latencies_us.push_back((clock.nsecsElapsed() - sent_at.value(id)) / 1000.0);
+            });
+            peer->connectToServer();
+            peers.push_back(peer);
+        }
+    }
+    const bool all_joined = waitUntil([&]() {
+        joined = 0;
+        for (auto peer : peers)
+        {
+            joined += peer->joined() ? 1 : 0;
+        }
+        return joined == peers.size();
+    }, 60000);
+    const qint64 join_ms = clock.elapsed();
+    const qint64 rss_joined = rssKb();
+
+    quint64 next_id = 0;
+    const int expected_per_round = sessions * (clients - 1);
+    for (int round = 0; round < rounds && all_joined; ++round)
+    {
+        const int expected = latencies_us.size() + expected_per_round;
+        for (int session = 0; session < sessions; ++session)
+        {
+            BenchClient* sender = peers[session * clients + round % clients];
+            sent_at.insert(next_id, clock.nsecsElapsed());
+            sender->sendOp(next_id++);
+        }
+        waitUntil([&]() { return latencies_us.size() >= expected; }, 10000);
+    }
+    const int hub_sessions = hub.sessionCount();
+    const int hub_peers = hub.peerCount();
+
+    QElapsedTimer teardown;
+    teardown.start();
+    for (auto peer : peers)
+    {
+        peer->disconnectFromServer();
+    }
+    const bool torn_down = waitUntil([&]() { return hub.sessionCount() == 0; }, 60000);
+
+    QJsonObject results;
+    results["transport"] = transport;
+    results["sessions"] = sessions;
+    results["clients_per_session"] = clients;
+    results["rounds"] = rounds;
+    results["joined"] = joined;
+    results["hub_sessions"] = hub_sessions;
+    results["hub_peers"] = hub_peers;
+    results["join_ms"] = join_ms;
+    results["rss_kb_before"] = rss_before;
+    results["rss_kb_joined"] = rss_joined;
+    results["rss_kb_per_session"] = sessions > 0 ? double(rss_joined - rss_before) / sessions : 0;
+    results["ops_sent"] = qint64(next_id);
+    results["receipts"] = latencies_us.size();
+    results["receipts_expected"] = qint64(next_id) * (clients - 1);
+    results["latency_us_p50"] = percentile(latencies_us, 0.5);
+    results["latency_us_p99"] = percentile(latencies_us, 0.99);
+    results["latency_us_max"] = percentile(latencies_us, 1.0);
+    results["teardown_ms"] = torn_down ? teardown.elapsed() : -1;
+    report("hub_sessions", results);
+
+    qDeleteAll(peers);
+    hub.stop();
+}
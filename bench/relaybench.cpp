@@ -0,0 +1,113 @@
+#include "bench.h"
+#include "benchclient.h"
+#include "hub.h"
+#include "networkworker.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QThread>
+
+namespace
+{
+    qint64 hostCpuNs(NetworkWorker* worker)
+    {
+        qint64 cpu_ns = 0;
+        QMetaObject::invokeMethod(worker, [&cpu_ns]() { cpu_ns = Bench::threadCpuNs(); }, Qt::BlockingQueuedConnection);
+        return cpu_ns;
+    }
+
+    int hostPeers(NetworkWorker* worker)
+    {
+        int peers = 0;
+        QMetaObject::invokeMethod(worker, [worker, &peers]() { peers = worker->peerCount(); }, Qt::BlockingQueuedConnection);
+        return peers;
+    }
+
+    QJsonObject relay(int clients, int ops, const QString& transport)
+    {
+        QJsonObject results;
+        QScopedPointer<Transport> client_transport(Transport::create(transport));
+        const QString session = QString("textedit-bench-relay-%1-%2").arg(QCoreApplication::applicationPid()).arg(clients);
+        QScopedPointer<NetworkWorker> worker(new NetworkWorker(session, new JsonSerializer, new JsonDeserializer, Transport::create(transport)));
+        QThread thread;
+        worker->moveToThread(&thread);
+        thread.setObjectName("network");
+        thread.start();
+        bool hosting = false;
+        NetworkWorker* host = worker.data();
+        QMetaObject::invokeMethod(host, [host, &hosting]() { hosting = host->startHub(); }, Qt::BlockingQueuedConnection);
+
+        QList<BenchClient*> peers;
+        qint64 receipts = 0;
+        for (int i = 0; i < clients && hosting; ++i)
+        {
+            BenchClient* peer = new BenchClient(client_transport.data(), session, session);
+            QObject::connect(peer, &BenchClient::received, [&receipts]() { ++receipts; });
+            peer->connectToServer();
+            peers.push_back(peer);
+        }
+        const bool all_joined = hosting && !peers.isEmpty() && Bench::waitUntil([&]() {
+            for (auto peer : peers)
+            {
+                if (!peer->joined())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }, 60000);
+
+        // One peer sends; the host sequences each op, acks it and relays it to everyone else.
+        const qint64 expected = qint64(ops) * (clients - 1);
+        const qint64 cpu_before = hostCpuNs(host);
+        QElapsedTimer clock;
+        clock.start();
+        for (int op = 0; op < ops && all_joined; ++op)
+        {
+            peers.first()->sendOp(op);
+        }
+        const bool delivered = all_joined && Bench::waitUntil([&]() { return receipts >= expected; }, 120000);
+        const qint64 elapsed_ms = clock.elapsed();
+        const qint64 cpu_ns = hostCpuNs(host) - cpu_before;
+
+        results["joined"] = all_joined;
+        results["host_peers"] = hostPeers(host);
+        results["receipts"] = receipts;
+        results["receipts_expected"] = expected;
+        results["delivery_ms"] = delivered ? elapsed_ms : -1;
+        results["ops_per_s"] = elapsed_ms > 0 ? ops * 1000.0 / elapsed_ms : 0;
+        results["host_cpu_us_per_op"] = ops > 0 ? cpu_ns / 1000.0 / ops : 0;
+        results["host_cpu_ns_per_delivery"] = expected > 0 ? double(cpu_ns) / expected : 0;
+
+        qDeleteAll(peers);
+        Bench::waitUntil([&]() { return hostPeers(host) == 0; }, 10000);
+        QMetaObject::invokeMethod(host, "stop", Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
+        return results;
+    }
+}
+
+// Host CPU spent relaying one op at several session sizes. The host runs on its own
+// thread, as in the editor, so its CPU time is measured apart from the clients', which
+// share the main thread.
+void Bench::relayFanout(const QList<int> &client_counts, int ops, const QString &transport)
+{
+    QScopedPointer<Transport> probe(Transport::create(transport));
+    if (probe.isNull())
+    {
+        qWarning() << "unknown transport" << transport;
+        return;
+    }
+    Hub::raiseFileLimit();
+    for (auto clients : client_counts)
+    {
+        QJsonObject results = relay(clients, ops, transport);
+        results["transport"] = transport;
+        results["clients"] = clients;
+        results["ops"] = ops;
+        report("relay_fanout", results);
+    }
+}
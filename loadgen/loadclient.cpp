@@ -0,0 +1,401 @@
+#include "loadclient.h"
+#include "documentops.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QTextBlock>
+#include <QTextCursor>
+
+#include <algorithm>
+
+LatencyTracker::LatencyTracker()
+{
+    m_clock.start();
+}
+
+qint64 LatencyTracker::now() const
+{
+    return m_clock.nsecsElapsed();
+}
+
+void LatencyTracker::acked(quint64 version, qint64 sent_ns)
+{
+    m_sentAt.insert(version, sent_ns);
+    for (auto received_ns : m_early.take(version))
+    {
+        m_latenciesMs.push_back((received_ns - sent_ns) / 1e6);
+    }
+}
+
+void LatencyTracker::received(quint64 version, qint64 received_ns)
+{
+    auto sent = m_sentAt.constFind(version);
+    if (sent == m_sentAt.constEnd())
+    {
+        m_early[version].push_back(received_ns);
+        return;
+    }
+    m_latenciesMs.push_back((received_ns - sent.value()) / 1e6);
+}
+
+QVector<double> LatencyTracker::latenciesMs() const
+{
+    return m_latenciesMs;
+}
+
+int LatencyTracker::unmatched() const
+{
+    int count = 0;
+    for (auto& receipts : m_early)
+    {
+        count += receipts.size();
+    }
+    return count;
+}
+
+LoadClient::LoadClient(Transport *transport, const QString &server, const QString &session, const QString &codec,
+                       const Trace &trace, LatencyTracker &tracker, quint32 seed, QObject *parent) :
+    QObject(parent),
+    m_socket(transport->createConnection(this)),
+    m_server(server),
+    m_session(session),
+    m_trace(trace),
+    m_tracker(tracker),
+    m_random(seed)
+{
+    if (codec == "binary")
+    {
+        m_serializer.reset(new BinarySerializer);
+        m_deserializer.reset(new BinaryDeserializer);
+    } else
+    {
+        m_serializer.reset(new JsonSerializer);
+        m_deserializer.reset(new JsonDeserializer);
+    }
+    m_stepTimer.setSingleShot(true);
+    connect(&m_stepTimer, &QTimer::timeout, this, &LoadClient::replayStep);
+    connect(m_socket, &Connection::connected, this, &LoadClient::connected);
+    connect(m_socket, &Connection::readyRead, this, &LoadClient::readyRead);
+    connect(&m_document, &QTextDocument::contentsChange, this, &LoadClient::localChange);
+}
+
+void LoadClient::connectToServer()
+{
+    m_socket->connectToServer(m_server);
+}
+
+void LoadClient::disconnectFromServer()
+{
+    stopReplay();
+    m_socket->disconnectFromServer();
+}
+
+void LoadClient::startReplay(double rate, double speed)
+{
+    m_rate = std::max(rate, 0.001);
+    m_speed = std::max(speed, 0.001);
+    if (m_trace.isRecorded())
+    {
+        m_traceIndex = m_random.bounded(m_trace.size());
+    }
+    // A random phase, so clients do not type in lockstep.
+    m_stepTimer.start(m_random.bounded(int(1000 / m_rate) + 1));
+}
+
+void LoadClient::stopReplay()
+{
+    m_stepTimer.stop();
+}
+
+bool LoadClient::joined() const
+{
+    return m_joined && !m_hostLost;
+}
+
+bool LoadClient::hostLost() const
+{
+    return m_hostLost;
+}
+
+bool LoadClient::settled() const
+{
+    return m_unacked.isEmpty();
+}
+
+QByteArray LoadClient::fingerprint(bool formatting) const
+{
+    const QString text = formatting ? m_document.toHtml() : m_document.toPlainText();
+    return QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Sha1);
+}
+
+LoadClient::Stats LoadClient::stats() const
+{
+    return m_stats;
+}
+
+void LoadClient::connected()
+{
+    Message hello;
+    hello.type = kHello;
+    hello.hello.session = m_session;
+    send(hello);
+}
+
+void LoadClient::readyRead()
+{
+    const QByteArray data = m_socket->device()->readAll();
+    m_stats.bytes_in += data.size();
+    m_reader.append(data);
+    QByteArray payload;
+    quint64 version = Framing::kNoVersion;
+    while (m_reader.next(payload, &version))
+    {
+        handleMessage(payload, version);
+    }
+}
+
+// The same steps as NetworkWorker and LocalServer on a client, minus failover.
+void LoadClient::handleMessage(const QByteArray &payload, quint64 version)
+{
+    if (version != Framing::kNoVersion && payload.isEmpty())
+    {
+        if (!m_unacked.isEmpty())
+        {
+            m_tracker.acked(version, m_unacked.takeFirst());
+            ++m_stats.acked;
+        }
+        return;
+    }
+    Message message;
+    if (!m_deserializer->ProcessOne(payload, message))
+    {
+        return;
+    }
+    switch (message.type)
+    {
+        case MessageType::kInit:
+        {
+            handleInit(message.init);
+            return;
+        }
+        case MessageType::kInitChunk:
+        {
+            if (m_initChunksLeft <= 0)
+            {
+                return;
+            }
+            DocumentOps::appendInitChunk(&m_document, message.init.fragment, m_formats);
+            if (--m_initChunksLeft == 0)
+            {
+                QList<Message> pending;
+                pending.swap(m_pendingOps);
+                for (auto& op : pending)
+                {
+                    applyMessage(op);
+                }
+            }
+            return;
+        }
+        case MessageType::kSnapshotRequest:
+        {
+            // A new hub session starts from its first joiner's document.
+            sendSnapshot();
+            m_joined = true;
+            return;
+        }
+        case MessageType::kRunServer:
+        case MessageType::kServerDown:
+        {
+            qDebug() << __FUNCTION__ << "the host left the session";
+            m_hostLost = true;
+            stopReplay();
+            return;
+        }
+        case MessageType::kHello:
+            return;
+        default:
+            break;
+    }
+
+    // A body after a catch-up repeats ops this replica has already seen.
+    if (version != Framing::kNoVersion && (m_lastVersion == Framing::kNoVersion || version > m_lastVersion))
+    {
+        m_lastVersion = version;
+        m_tracker.received(version, m_tracker.now());
+        ++m_stats.received;
+    }
+    if (m_initChunksLeft > 0 && (!m_pendingOps.isEmpty() || !DocumentOps::isReceived(&m_document, message)))
+    {
+        m_pendingOps.push_back(message);
+    } else
+    {
+        applyMessage(message);
+    }
+}
+
+void LoadClient::applyMessage(const Message &message)
+{
+    switch (message.type)
+    {
+        case MessageType::kContentChangedWithHtml:
+            DocumentOps::changeContentWithHtml(&m_document, message.content);
+            break;
+        case MessageType::kContentChangedWithPlain:
+            DocumentOps::changeContentWithPlain(&m_document, message.content);
+            break;
+        case MessageType::kContentChangedWithFragment:
+            DocumentOps::changeContentWithFragment(&m_document, message.content, m_formats);
+            break;
+        case MessageType::kStyleChanged:
+            DocumentOps::changeContentStyle(&m_document, message.style);
+            break;
+        case MessageType::kCharFormatChanged:
+            DocumentOps::changeCharFormat(&m_document, message.format);
+            break;
+        case MessageType::kReset:
+            m_document.setHtml(message.reset.html);
+            break;
+        default:
+            break;
+    }
+}
+
+// Whatever this client had sent is in the new document or lost with the old one.
+void LoadClient::handleInit(const InitMessage &message)
+{
+    if (m_joined)
+    {
+        ++m_stats.resets;
+    }
+    m_unacked.clear();
+    m_formats.load(message.formats);
+    m_pendingOps.clear();
+    m_initChunksLeft = 0;
+    if (!message.html.isEmpty())
+    {
+        m_document.setHtml(message.html);
+    } else
+    {
+        m_document.clear();
+        if (!message.fragment.isEmpty())
+        {
+            DocumentOps::appendInitChunk(&m_document, message.fragment, m_formats);
+        }
+        m_initChunksLeft = message.chunks - 1;
+    }
+    m_joined = true;
+}
+
+// A hub asks one of its peers for the document now and then.
+void LoadClient::sendSnapshot()
+{
+    Message answer;
+    answer.type = kSnapshot;
+    for (auto& message : DocumentOps::snapshot(&m_document, m_formats))
+    {
+        answer.snapshot.payloads.push_back(m_serializer->Process(message));
+    }
+    const QByteArray frame = Framing::pack(m_serializer->Process(answer));
+    m_stats.bytes_out += frame.size();
+    m_socket->device()->write(frame);
+    m_socket->flush();
+}
+
+void LoadClient::send(const Message &message)
+{
+    const QByteArray frame = Framing::pack(m_serializer->Process(message));
+    m_stats.bytes_out += frame.size();
+    m_socket->device()->write(frame);
+    m_socket->flush();
+    if (message.type != kHello)
+    {
+        m_unacked.push_back(m_tracker.now());
+        ++m_stats.sent;
+    }
+}
+
+void LoadClient::replayStep()
+{
+    if (!joined())
+    {
+        return;
+    }
+    perform(m_trace.step(m_traceIndex++, m_random));
+    scheduleStep();
+}
+
+void LoadClient::scheduleStep()
+{
+    double delay_ms = 0;
+    if (m_trace.isRecorded())
+    {
+        delay_ms = m_trace.step(m_traceIndex, m_random).delay_ms / m_speed;
+    } else
+    {
+        delay_ms = 1000 / m_rate * (0.5 + m_random.generateDouble());
+    }
+    m_stepTimer.start(int(delay_ms));
+}
+
+// Edits the replica as a user would at the cursor. Text changes reach localChange()
+// through contentsChange, as in the editor; format changes are sent from here.
+void LoadClient::perform(const TraceStep &step)
+{
+    const int end = m_document.characterCount() - 1;
+    m_cursor = m_random.bounded(20) == 0 ? m_random.bounded(end + 1) : qBound(0, m_cursor, end);
+    QTextCursor cursor(&m_document);
+    cursor.setPosition(m_cursor);
+    switch (step.kind)
+    {
+        case TraceStep::kKeystroke:
+        case TraceStep::kPaste:
+        {
+            m_performing = true;
+            cursor.insertText(step.text);
+            m_performing = false;
+            m_cursor += step.text.size();
+            break;
+        }
+        case TraceStep::kBackspace:
+        {
+            if (m_cursor == 0)
+            {
+                break;
+            }
+            m_performing = true;
+            cursor.deletePreviousChar();
+            m_performing = false;
+            --m_cursor;
+            break;
+        }
+        case TraceStep::kStyle:
+        {
+            QTextBlockFormat format = cursor.blockFormat();
+            format.setHeadingLevel((format.headingLevel() + 1) % 4);
+            cursor.setBlockFormat(format);
+            send(DocumentOps::styleChange(&m_document, cursor.block().position(), 0));
+            break;
+        }
+        case TraceStep::kBold:
+        {
+            cursor.setPosition(std::min(m_cursor + step.length, end), QTextCursor::KeepAnchor);
+            if (!cursor.hasSelection())
+            {
+                break;
+            }
+            QTextCharFormat format;
+            format.setFontWeight(m_random.bounded(2) ? QFont::Bold : QFont::Normal);
+            cursor.mergeCharFormat(format);
+            send(DocumentOps::charFormatChange(cursor.selectionStart(), cursor.selectionEnd() - cursor.selectionStart(), format));
+            break;
+        }
+    }
+}
+
+void LoadClient::localChange(int position, int removed, int added)
+{
+    if (m_performing)
+    {
+        send(DocumentOps::contentChange(&m_document, position, removed, added, 0, m_formats));
+    }
+}
@@ -0,0 +1,145 @@
+#ifndef LOADCLIENT_H
+#define LOADCLIENT_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QRandomGenerator>
+#include <QScopedPointer>
+#include <QTextDocument>
+#include <QTimer>
+#include <QVector>
+
+#include "serialization.h"
+#include "framing.h"
+#include "richfragment.h"
+#include "transport.h"
+#include "trace.h"
+
+// Pairs every op's send time, which its sender learns from the host's ack, with its
+// arrival at every other client; either may come first.
+class LatencyTracker
+{
+public:
+    LatencyTracker();
+
+    qint64 now() const;
+
+    void acked(quint64 version, qint64 sent_ns);
+
+    void received(quint64 version, qint64 received_ns);
+
+    // End-to-end latencies of everything both sent and received so far.
+    QVector<double> latenciesMs() const;
+
+    // Arrivals of ops whose ack has not come yet.
+    int unmatched() const;
+
+private:
+    QElapsedTimer m_clock;
+    QHash<quint64, qint64> m_sentAt;
+    QHash<quint64, QVector<qint64>> m_early;
+    QVector<double> m_latenciesMs;
+};
+
+// A synthetic peer: joins a session like the editor does, keeps a replica of the document
+// in a QTextDocument and replays a trace at its own cursor, sending exactly the ops
+// LocalServer would. It cannot host, so it stops when the host leaves.
+class LoadClient : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats
+    {
+        quint64 sent = 0;
+        quint64 acked = 0;
+        quint64 received = 0;
+        // Snapshots after the first one: the host reset this replica.
+        quint64 resets = 0;
+        quint64 bytes_in = 0;
+        quint64 bytes_out = 0;
+    };
+
+    // transport and tracker have to outlive the client.
+    LoadClient(Transport* transport, const QString& server, const QString& session, const QString& codec,
+               const Trace& trace, LatencyTracker& tracker, quint32 seed, QObject* parent = nullptr);
+
+    void connectToServer();
+
+    void disconnectFromServer();
+
+    // A step every 1000 / rate ms on average or, for a recorded trace, when it says, sped up by speed.
+    void startReplay(double rate, double speed);
+
+    void stopReplay();
+
+    // Has the document, and the host has not gone away since.
+    bool joined() const;
+
+    bool hostLost() const;
+
+    // Every op sent has been acknowledged.
+    bool settled() const;
+
+    // The document as plain text, or with its formatting.
+    QByteArray fingerprint(bool formatting) const;
+
+    Stats stats() const;
+
+private slots:
+    void connected();
+
+    void readyRead();
+
+    void replayStep();
+
+    void localChange(int position, int removed, int added);
+
+private:
+    void handleMessage(const QByteArray& payload, quint64 version);
+
+    void applyMessage(const Message& message);
+
+    void handleInit(const InitMessage& message);
+
+    void sendSnapshot();
+
+    void send(const Message& message);
+
+    void scheduleStep();
+
+    void perform(const TraceStep& step);
+
+    Connection* m_socket;
+    QString m_server;
+    QString m_session;
+    FrameReader m_reader;
+    QScopedPointer<ISerializer> m_serializer;
+    QScopedPointer<IDeserializer> m_deserializer;
+
+    const Trace& m_trace;
+    LatencyTracker& m_tracker;
+    QRandomGenerator m_random;
+    QTimer m_stepTimer;
+    double m_rate = 1;
+    double m_speed = 1;
+    int m_traceIndex = 0;
+    int m_cursor = 0;
+
+    QTextDocument m_document;
+    FormatTable m_formats;
+    int m_initChunksLeft = 0;
+    QList<Message> m_pendingOps;
+    // The newest version applied, and whether the replica is being edited locally.
+    quint64 m_lastVersion = Framing::kNoVersion;
+    bool m_performing = false;
+
+    // Send times of the ops the host has not acknowledged yet, oldest first.
+    QList<qint64> m_unacked;
+
+    bool m_joined = false;
+    bool m_hostLost = false;
+    Stats m_stats;
+};
+
+#endif // LOADCLIENT_H
@@ -0,0 +1,260 @@
+#include "bench.h"
+#include "loadclient.h"
+#include "networkworker.h"
+#include "hub.h"
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonObject>
+#include <QScopedPointer>
+#include <QTimer>
+
+#include <algorithm>
+
+#include <unistd.h>
+
+namespace
+{
+    // CPU seconds the process has used so far, from /proc; negative if it is not there.
+    double processCpuSeconds(qint64 pid)
+    {
+        QFile stat(QString("/proc/%1/stat").arg(pid));
+        if (!stat.open(QIODevice::ReadOnly))
+        {
+            return -1;
+        }
+        // The command name may contain spaces; the fields after it do not.
+        const QByteArray line = stat.readAll();
+        const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+        if (fields.size() < 13)
+        {
+            return -1;
+        }
+        return (fields[11].toLongLong() + fields[12].toLongLong()) / double(sysconf(_SC_CLK_TCK));
+    }
+
+    qint64 processRssKb(qint64 pid)
+    {
+        QFile status(QString("/proc/%1/status").arg(pid));
+        if (!status.open(QIODevice::ReadOnly))
+        {
+            return -1;
+        }
+        for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine())
+        {
+            if (line.startsWith("VmRSS:"))
+            {
+                return line.mid(6).simplified().split(' ').value(0).toLongLong();
+            }
+        }
+        return -1;
+    }
+
+    // Replicas whose fingerprint differs from the one most of them share.
+    int divergentReplicas(const QList<LoadClient*>& clients, bool formatting)
+    {
+        QHash<QByteArray, int> counts;
+        int comparable = 0;
+        for (auto client : clients)
+        {
+            if (client->joined())
+            {
+                ++counts[client->fingerprint(formatting)];
+                ++comparable;
+            }
+        }
+        int majority = 0;
+        for (auto count : counts)
+        {
+            majority = std::max(majority, count);
+        }
+        return comparable - majority;
+    }
+
+    // Peers reach a session through a running hub if there is one, as the editor does.
+    QString serverFor(Transport* transport, const QString& session)
+    {
+        QScopedPointer<Connection> probe(transport->createConnection(nullptr));
+        probe->connectToServer(NetworkWorker::hubName());
+        const bool via_hub = probe->waitForConnected(100);
+        probe->abort();
+        return via_hub ? NetworkWorker::hubName() : session;
+    }
+}
+
+// Connects synthetic clients to a live session, replays a trace on every one of them and
+// prints one JSON object with what it measured.
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication a(argc, argv);
+    QCoreApplication::setApplicationName("textedit_load");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays typing traces from synthetic clients against a running session.");
+    parser.addHelpOption();
+    QCommandLineOption session_option("session", "Session to join.", "name", "default");
+    parser.addOption(session_option);
+    QCommandLineOption clients_option("clients", "Synthetic clients.", "count", "10");
+    parser.addOption(clients_option);
+    QCommandLineOption transport_option("transport", "local, shm or tcp[:host[:port]]; as the session uses.", "transport", "local");
+    parser.addOption(transport_option);
+    QCommandLineOption codec_option("codec", "json or binary; as the session uses.", "codec", "json");
+    parser.addOption(codec_option);
+    QCommandLineOption rate_option("rate", "Steps per second per client, synthetic mix only.", "rate", "5");
+    parser.addOption(rate_option);
+    QCommandLineOption mix_option("mix", "Weights of synthetic steps.", "mix", "keystroke=80,backspace=8,paste=2,style=5,bold=5");
+    parser.addOption(mix_option);
+    QCommandLineOption trace_option("trace", "Recorded trace to replay instead, as JSON lines.", "file");
+    parser.addOption(trace_option);
+    QCommandLineOption speed_option("speed", "Replays a recorded trace this many times faster.", "factor", "1");
+    parser.addOption(speed_option);
+    QCommandLineOption duration_option("duration", "Seconds to replay for.", "seconds", "30");
+    parser.addOption(duration_option);
+    QCommandLineOption settle_option("settle", "Milliseconds to wait for acks and deliveries afterwards.", "ms", "5000");
+    parser.addOption(settle_option);
+    QCommandLineOption host_pid_option("host-pid", "Process hosting the session, for its CPU and RSS.", "pid");
+    parser.addOption(host_pid_option);
+    parser.process(a);
+
+    QScopedPointer<Transport> transport(Transport::create(parser.value(transport_option)));
+    if (transport.isNull())
+    {
+        qWarning() << "unknown transport" << parser.value(transport_option);
+        return 1;
+    }
+    Trace trace;
+    if (!trace.setMix(parser.value(mix_option)))
+    {
+        qWarning() << "bad mix" << parser.value(mix_option);
+        return 1;
+    }
+    QString error;
+    if (parser.isSet(trace_option) && !trace.load(parser.value(trace_option), error))
+    {
+        qWarning() << "cannot read trace" << parser.value(trace_option) << error;
+        return 1;
+    }
+    const int client_count = parser.value(clients_option).toInt();
+    const qint64 host_pid = parser.isSet(host_pid_option) ? parser.value(host_pid_option).toLongLong() : -1;
+    Hub::raiseFileLimit();
+
+    const QString session = parser.value(session_option);
+    const QString server = serverFor(transport.data(), session);
+    LatencyTracker tracker;
+    QList<LoadClient*> clients;
+    for (int i = 0; i < client_count; ++i)
+    {
+        LoadClient* client = new LoadClient(transport.data(), server, session, parser.value(codec_option), trace, tracker, quint32(i + 1), &a);
+        client->connectToServer();
+        clients.push_back(client);
+    }
+    QElapsedTimer join_clock;
+    join_clock.start();
+    int joined = 0;
+    Bench::waitUntil([&]() {
+        joined = 0;
+        for (auto client : clients)
+        {
+            joined += client->joined() ? 1 : 0;
+        }
+        return joined == clients.size();
+    }, 30000);
+    const qint64 join_ms = join_clock.elapsed();
+
+    const double host_cpu_before = host_pid > 0 ? processCpuSeconds(host_pid) : -1;
+    qint64 host_rss_peak = -1;
+    QTimer rss_sampler;
+    QObject::connect(&rss_sampler, &QTimer::timeout, [&]() { host_rss_peak = std::max(host_rss_peak, processRssKb(host_pid)); });
+    if (host_pid > 0)
+    {
+        rss_sampler.start(500);
+    }
+
+    QElapsedTimer run_clock;
+    run_clock.start();
+    for (auto client : clients)
+    {
+        client->startReplay(parser.value(rate_option).toDouble(), parser.value(speed_option).toDouble());
+    }
+    const int duration_ms = int(parser.value(duration_option).toDouble() * 1000);
+    Bench::waitUntil([&]() { return run_clock.elapsed() >= duration_ms; }, duration_ms + 1000);
+    for (auto client : clients)
+    {
+        client->stopReplay();
+    }
+    const qint64 run_ms = run_clock.elapsed();
+    const double host_cpu = host_pid > 0 ? processCpuSeconds(host_pid) - host_cpu_before : -1;
+
+    const bool settled = Bench::waitUntil([&]() {
+        for (auto client : clients)
+        {
+            if (client->joined() && !client->settled())
+            {
+                return false;
+            }
+        }
+        return tracker.unmatched() == 0;
+    }, parser.value(settle_option).toInt());
+    rss_sampler.stop();
+
+    LoadClient::Stats total;
+    int host_lost = 0;
+    for (auto client : clients)
+    {
+        const LoadClient::Stats stats = client->stats();
+        total.sent += stats.sent;
+        total.acked += stats.acked;
+        total.received += stats.received;
+        total.resets += stats.resets;
+        total.bytes_in += stats.bytes_in;
+        total.bytes_out += stats.bytes_out;
+        host_lost += client->hostLost() ? 1 : 0;
+    }
+    const QVector<double> latencies = tracker.latenciesMs();
+
+    QJsonObject results;
+    results["session"] = session;
+    results["server"] = server;
+    results["transport"] = parser.value(transport_option);
+    results["trace"] = trace.isRecorded() ? parser.value(trace_option) : parser.value(mix_option);
+    results["clients"] = client_count;
+    results["joined"] = joined;
+    results["join_ms"] = join_ms;
+    results["run_ms"] = run_ms;
+    results["ops_sent"] = qint64(total.sent);
+    results["ops_acked"] = qint64(total.acked);
+    results["deliveries"] = qint64(total.received);
+    results["ops_per_s"] = run_ms > 0 ? total.acked * 1000.0 / run_ms : 0;
+    results["deliveries_per_s"] = run_ms > 0 ? total.received * 1000.0 / run_ms : 0;
+    results["bytes_in"] = qint64(total.bytes_in);
+    results["bytes_out"] = qint64(total.bytes_out);
+    results["latency_ms_p50"] = Bench::percentile(latencies, 0.5);
+    results["latency_ms_p99"] = Bench::percentile(latencies, 0.99);
+    results["latency_ms_p999"] = Bench::percentile(latencies, 0.999);
+    results["latency_ms_max"] = Bench::percentile(latencies, 1.0);
+    results["latency_samples"] = latencies.size();
+    results["settled"] = settled;
+    results["resets"] = qint64(total.resets);
+    results["host_lost"] = host_lost;
+    results["host_cpu_percent"] = host_cpu >= 0 && run_ms > 0 ? host_cpu * 100000.0 / run_ms : -1;
+    results["host_rss_kb_peak"] = host_rss_peak;
+    results["divergent_replicas"] = divergentReplicas(clients, false);
+    results["divergent_formatting"] = divergentReplicas(clients, true);
+    Bench::report("load", results);
+
+    for (auto client : clients)
+    {
+        client->disconnectFromServer();
+    }
+    Bench::waitUntil([]() { return false; }, 100);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "trace.h"
+
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+namespace
+{
+    const QHash<QString, TraceStep::Kind> kKinds = {
+        {"keystroke", TraceStep::kKeystroke},
+        {"backspace", TraceStep::kBackspace},
+        {"paste", TraceStep::kPaste},
+        {"style", TraceStep::kStyle},
+        {"bold", TraceStep::kBold}
+    };
+
+    const QStringList kWords = QStringList() << "the" << "review" << "meeting" << "agreed" << "to" << "move"
+                                             << "section" << "three" << "after" << "budget" << "and" << "draft"
+                                             << "a" << "summary" << "for" << "everyone" << "before" << "Friday";
+
+    QString words(QRandomGenerator& random, int characters)
+    {
+        QString text;
+        while (text.size() < characters)
+        {
+            text += kWords[random.bounded(kWords.size())];
+            text += random.bounded(12) == 0 ? "\n" : " ";
+        }
+        return text;
+    }
+}
+
+Trace::Trace()
+{
+    setMix("keystroke=80,backspace=8,paste=2,style=5,bold=5");
+}
+
+bool Trace::setMix(const QString &mix)
+{
+    QList<QPair<TraceStep::Kind, int>> weights;
+    int total = 0;
+    for (auto& entry : mix.split(',', Qt::SkipEmptyParts))
+    {
+        const QStringList parts = entry.split('=');
+        bool ok = false;
+        const int weight = parts.value(1).toInt(&ok);
+        if (parts.size() != 2 || !ok || weight < 0 || !kKinds.contains(parts[0].trimmed()))
+        {
+            return false;
+        }
+        total += weight;
+        weights.push_back(qMakePair(kKinds.value(parts[0].trimmed()), total));
+    }
+    if (total == 0)
+    {
+        return false;
+    }
+    m_mix = weights;
+    m_totalWeight = total;
+    return true;
+}
+
+bool Trace::load(const QString &path, QString &error)
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly))
+    {
+        error = file.errorString();
+        return false;
+    }
+    QList<TraceStep> steps;
+    int line_number = 0;
+    for (QByteArray line = file.readLine(); !line.isEmpty(); line = file.readLine())
+    {
+        ++line_number;
+        if (line.trimmed().isEmpty())
+        {
+            continue;
+        }
+        const QJsonObject object = QJsonDocument::fromJson(line).object();
+        const QString kind = object.value("kind").toString();
+        if (!kKinds.contains(kind))
+        {
+            error = QString("line %1: unknown kind \"%2\"").arg(line_number).arg(kind);
+            return false;
+        }
+        TraceStep step;
+        step.kind = kKinds.value(kind);
+        step.text = object.value("text").toString();
+        step.length = object.value("length").toInt(1);
+        step.delay_ms = object.value("delay_ms").toInt();
+        steps.push_back(step);
+    }
+    if (steps.isEmpty())
+    {
+        error = "no steps";
+        return false;
+    }
+    m_steps = steps;
+    return true;
+}
+
+bool Trace::isRecorded() const
+{
+    return !m_steps.isEmpty();
+}
+
+int Trace::size() const
+{
+    return m_steps.size();
+}
+
+TraceStep Trace::step(int index, QRandomGenerator &random) const
+{
+    if (isRecorded())
+    {
+        return m_steps[index % m_steps.size()];
+    }
+    return randomStep(random);
+}
+
+TraceStep Trace::randomStep(QRandomGenerator &random) const
+{
+    TraceStep step;
+    const int pick = random.bounded(m_totalWeight);
+    for (auto& entry : m_mix)
+    {
+        if (pick < entry.second)
+        {
+            step.kind = entry.first;
+            break;
+        }
+    }
+    switch (step.kind)
+    {
+        case TraceStep::kKeystroke:
+            step.text = random.bounded(6) == 0 ? QString(" ") : QString(QChar('a' + random.bounded(26)));
+            break;
+        case TraceStep::kPaste:
+            step.text = words(random, 200 + random.bounded(1800));
+            break;
+        case TraceStep::kBold:
+            step.length = 1 + random.bounded(20);
+            break;
+        default:
+            break;
+    }
+    return step;
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QList>
+#include <QPair>
+#include <QRandomGenerator>
+#include <QString>
+
+// One thing a user does at their cursor.
+struct TraceStep
+{
+    enum Kind
+    {
+        kKeystroke,
+        kBackspace,
+        kPaste,
+        kStyle,
+        kBold
+    };
+
+    Kind kind = kKeystroke;
+    // Keystroke and paste: what is typed.
+    QString text;
+    // Bold: how many characters from the cursor on.
+    int length = 0;
+    // Recorded traces: time since the previous step.
+    int delay_ms = 0;
+};
+
+// What synthetic clients replay: a recorded trace, which each client walks on its own
+// from a random starting point, or random steps drawn from a weighted mix.
+class Trace
+{
+public:
+    Trace();
+
+    // "keystroke=80,backspace=8,paste=2,style=5,bold=5"; false if it does not parse.
+    bool setMix(const QString& mix);
+
+    // JSON lines like {"delay_ms": 120, "kind": "keystroke", "text": "a"}.
+    bool load(const QString& path, QString& error);
+
+    bool isRecorded() const;
+
+    int size() const;
+
+    // Step index of a recorded trace, or a random step from the mix.
+    TraceStep step(int index, QRandomGenerator& random) const;
+
+private:
+    TraceStep randomStep(QRandomGenerator& random) const;
+
+    QList<TraceStep> m_steps;
+    // Kinds with their cumulative weights.
+    QList<QPair<TraceStep::Kind, int>> m_mix;
+    int m_totalWeight = 0;
+};
+
+#endif // TRACE_H
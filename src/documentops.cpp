@@ -0,0 +1,312 @@
+#include "documentops.h"
+
+#include <QTextDocument>
+#include <QTextDocumentFragment>
+#include <QTextCursor>
+#include <QTextBlock>
+#include <QTextList>
+#include <QTextFrame>
+
+#include <algorithm>
+
+namespace
+{
+    const int kSnapshotChunkChars = 16 * 1024;
+
+    // Text inserted inside one block with the same char format as the character before it
+    // can be replayed with QTextCursor::insertText, which picks up exactly that format.
+    bool plainInsertText(QTextDocument* document, int position, int length, QString& text)
+    {
+        QTextBlock block = document->findBlock(position);
+        if (!block.isValid() || position == block.position()
+                || position + length > block.position() + block.length() - 1)
+        {
+            return false;
+        }
+
+        QTextCursor cursor(document);
+        cursor.setPosition(position);
+        const QTextCharFormat format = cursor.charFormat();
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it)
+        {
+            QTextFragment fragment = it.fragment();
+            if (fragment.position() + fragment.length() <= position || fragment.position() >= position + length)
+            {
+                continue;
+            }
+            if (fragment.charFormat() != format)
+            {
+                return false;
+            }
+        }
+
+        cursor.setPosition(position + length, QTextCursor::KeepAnchor);
+        text = cursor.selectedText();
+        return true;
+    }
+
+    // A frame spans its first position to its last plus the separators around them.
+    bool crossesFrame(QTextDocument* document, int position, int length)
+    {
+        for (auto frame : document->rootFrame()->childFrames())
+        {
+            if (frame->firstPosition() - 1 <= position + length && frame->lastPosition() + 1 >= position)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+Message DocumentOps::contentChange(QTextDocument *document, int position, int removed, int added, int offset, FormatTable &formats)
+{
+    Message message;
+    message.type = kContentChangedWithPlain;
+    message.content.position = position;
+    message.content.removed = removed;
+    if (!added || plainInsertText(document, position + offset, added, message.content.added))
+    {
+        return message;
+    }
+    // RichFragment only knows blocks; tables and other frames go as HTML, as snapshots do.
+    if (crossesFrame(document, position + offset, added))
+    {
+        QTextCursor cursor(document);
+        cursor.setPosition(position + offset);
+        cursor.setPosition(position + offset + added, QTextCursor::KeepAnchor);
+        message.type = kContentChangedWithHtml;
+        message.content.added = QTextDocumentFragment(cursor).toHtml();
+        return message;
+    }
+    message.type = kContentChangedWithFragment;
+    message.content.fragment = RichFragment::encode(document, position + offset, added, formats);
+    return message;
+}
+
+Message DocumentOps::styleChange(QTextDocument *document, int position, int length)
+{
+    QTextBlock block = document->findBlock(position);
+    QTextBlockFormat block_format = block.blockFormat();
+    block_format.clearProperty(QTextFormat::ObjectIndex);
+
+    Message message;
+    message.type = kStyleChanged;
+    message.style.position = position;
+    message.style.length = length;
+    message.style.block_format = RichFragment::saveFormat(block_format);
+    if (block.textList())
+    {
+        message.style.list_format = RichFragment::saveFormat(block.textList()->format());
+    }
+    return message;
+}
+
+Message DocumentOps::charFormatChange(int position, int length, const QTextCharFormat &format)
+{
+    Message message;
+    message.type = kCharFormatChanged;
+    CharFormatMessage& delta = message.format;
+    delta.position = position;
+    delta.length = length;
+    if (format.hasProperty(QTextFormat::FontWeight))
+    {
+        delta.properties |= CharFormatMessage::kBold;
+        delta.bold = format.fontWeight() > QFont::Normal;
+    }
+    if (format.hasProperty(QTextFormat::TextUnderlineStyle) || format.hasProperty(QTextFormat::FontUnderline))
+    {
+        delta.properties |= CharFormatMessage::kUnderline;
+        delta.underline = format.fontUnderline();
+    }
+    if (format.hasProperty(QTextFormat::FontItalic))
+    {
+        delta.properties |= CharFormatMessage::kItalic;
+        delta.italic = format.fontItalic();
+    }
+    if (format.hasProperty(QTextFormat::FontFamily))
+    {
+        delta.properties |= CharFormatMessage::kFamily;
+        delta.family = format.fontFamily();
+    }
+    if (format.hasProperty(QTextFormat::FontPointSize))
+    {
+        delta.properties |= CharFormatMessage::kSize;
+        delta.size = format.fontPointSize();
+    }
+    if (format.hasProperty(QTextFormat::ForegroundBrush))
+    {
+        delta.properties |= CharFormatMessage::kColor;
+        delta.color = format.foreground().color().rgba();
+    }
+    if (format.hasProperty(QTextFormat::FontSizeAdjustment))
+    {
+        delta.properties |= CharFormatMessage::kSizeAdjustment;
+        delta.size_adjustment = format.intProperty(QTextFormat::FontSizeAdjustment);
+    }
+    return message;
+}
+
+// The document is cut into chunks of whole blocks so joiners can show the first screenful
+// while the rest is still on its way.
+QList<Message> DocumentOps::snapshot(QTextDocument *document, const FormatTable &announced)
+{
+    QList<Message> snapshot;
+
+    Message message;
+    message.type = kInit;
+    message.init.formats = announced.save();
+    if (!document->rootFrame()->childFrames().isEmpty())
+    {
+        message.init.html = document->toHtml();
+        snapshot.push_back(message);
+        return snapshot;
+    }
+
+    // Formats first seen here reach only the joiner, so they must not be marked as announced.
+    FormatTable formats = announced;
+    QList<QByteArray> fragments;
+    const int end = document->characterCount() - 1;
+    int start = 0;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next())
+    {
+        const int block_end = block.position() + block.length();
+        if (block_end - start >= kSnapshotChunkChars || !block.next().isValid())
+        {
+            const int chunk_end = std::min(block_end, end);
+            fragments.push_back(RichFragment::encode(document, start, chunk_end - start, formats, false));
+            start = chunk_end;
+        }
+    }
+
+    message.init.fragment = fragments.first();
+    message.init.chunks = fragments.size();
+    snapshot.push_back(message);
+
+    Message chunk;
+    chunk.type = kInitChunk;
+    for (int i = 1; i < fragments.size(); ++i)
+    {
+        chunk.init.fragment = fragments[i];
+        snapshot.push_back(chunk);
+    }
+    return snapshot;
+}
+
+void DocumentOps::changeContentWithHtml(QTextDocument *document, const ContentChangedMessage &message)
+{
+    QTextCursor cursor(document);
+    cursor.setPosition(message.position);
+
+    cursor.beginEditBlock();
+
+    for (int i = 0; i < message.removed; ++i)
+    {
+        cursor.deleteChar();
+    }
+
+    if (!message.added.isEmpty())
+    {
+        cursor.insertFragment(QTextDocumentFragment::fromHtml(message.added));
+    }
+
+    cursor.endEditBlock();
+}
+
+void DocumentOps::changeContentWithPlain(QTextDocument *document, const ContentChangedMessage &message)
+{
+    QTextCursor cursor(document);
+    cursor.setPosition(message.position);
+
+    cursor.beginEditBlock();
+    if (message.removed > 0)
+    {
+        cursor.setPosition(message.position + message.removed, QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+    }
+    if (!message.added.isEmpty())
+    {
+        cursor.insertText(message.added);
+    }
+    cursor.endEditBlock();
+}
+
+void DocumentOps::changeContentWithFragment(QTextDocument *document, const ContentChangedMessage &message, FormatTable &formats)
+{
+    QTextCursor cursor(document);
+    cursor.setPosition(message.position);
+
+    cursor.beginEditBlock();
+    if (message.removed > 0)
+    {
+        cursor.setPosition(message.position + message.removed, QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+    }
+    RichFragment::apply(cursor, message.fragment, formats);
+    cursor.endEditBlock();
+}
+
+void DocumentOps::changeContentStyle(QTextDocument *document, const StyleChangedMessage &message)
+{
+    QTextCursor cursor(document);
+    cursor.setPosition(message.position);
+    cursor.setPosition(message.position + message.length, QTextCursor::KeepAnchor);
+    cursor.beginEditBlock();
+    cursor.setBlockFormat(RichFragment::loadFormat(message.block_format).toBlockFormat());
+    if (!message.list_format.isEmpty())
+    {
+        cursor.createList(RichFragment::loadFormat(message.list_format).toListFormat());
+    }
+    cursor.endEditBlock();
+}
+
+void DocumentOps::changeCharFormat(QTextDocument *document, const CharFormatMessage &message)
+{
+    QTextCharFormat format;
+    if (message.properties & CharFormatMessage::kBold)
+        format.setFontWeight(message.bold ? QFont::Bold : QFont::Normal);
+    if (message.properties & CharFormatMessage::kUnderline)
+        format.setFontUnderline(message.underline);
+    if (message.properties & CharFormatMessage::kItalic)
+        format.setFontItalic(message.italic);
+    if (message.properties & CharFormatMessage::kFamily)
+        format.setFontFamily(message.family);
+    if (message.properties & CharFormatMessage::kSize)
+        format.setFontPointSize(message.size);
+    if (message.properties & CharFormatMessage::kColor)
+        format.setForeground(QColor::fromRgba(message.color));
+    if (message.properties & CharFormatMessage::kSizeAdjustment)
+        format.setProperty(QTextFormat::FontSizeAdjustment, message.size_adjustment);
+
+    QTextCursor cursor(document);
+    cursor.setPosition(message.position);
+    cursor.setPosition(message.position + message.length, QTextCursor::KeepAnchor);
+    cursor.mergeCharFormat(format);
+}
+
+void DocumentOps::appendInitChunk(QTextDocument *document, const QByteArray &fragment, FormatTable &formats)
+{
+    QTextCursor cursor(document);
+    cursor.movePosition(QTextCursor::End);
+    cursor.beginEditBlock();
+    RichFragment::apply(cursor, fragment, formats, false);
+    cursor.endEditBlock();
+}
+
+bool DocumentOps::isReceived(QTextDocument *document, const Message &message)
+{
+    const int received = document->characterCount() - 1;
+    switch (message.type)
+    {
+        case MessageType::kContentChangedWithHtml:
+        case MessageType::kContentChangedWithPlain:
+        case MessageType::kContentChangedWithFragment:
+            return message.content.position + message.content.removed < received;
+        case MessageType::kStyleChanged:
+            return message.style.position + message.style.length < received;
+        case MessageType::kCharFormatChanged:
+            return message.format.position + message.format.length < received;
+        default:
+            return false;
+    }
+}
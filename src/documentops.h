@@ -0,0 +1,49 @@
+#ifndef DOCUMENTOPS_H
+#define DOCUMENTOPS_H
+
+#include <QList>
+#include <QTextCharFormat>
+
+#include "messages.h"
+#include "richfragment.h"
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+// Turning edits of a QTextDocument into session ops and applying remote ops to one,
+// without the editor around it: LocalServer does both for its TextEdit, textedit_load
+// for the replicas of its synthetic clients.
+namespace DocumentOps
+{
+    // Old text [position, position + removed) became [position, position + added), which
+    // has since moved by offset in document. Plain text when the formats allow it, HTML
+    // when it touches a table or another frame.
+    Message contentChange(QTextDocument* document, int position, int removed, int added, int offset, FormatTable& formats);
+
+    Message styleChange(QTextDocument* document, int position, int length);
+
+    // The properties of format peers understand; none set if there is nothing to send.
+    Message charFormatChange(int position, int length, const QTextCharFormat& format);
+
+    // The document as kInit and kInitChunk messages, for a joiner.
+    QList<Message> snapshot(QTextDocument* document, const FormatTable& announced);
+
+    void changeContentWithHtml(QTextDocument* document, const ContentChangedMessage& message);
+
+    void changeContentWithPlain(QTextDocument* document, const ContentChangedMessage& message);
+
+    void changeContentWithFragment(QTextDocument* document, const ContentChangedMessage& message, FormatTable& formats);
+
+    void changeContentStyle(QTextDocument* document, const StyleChangedMessage& message);
+
+    void changeCharFormat(QTextDocument* document, const CharFormatMessage& message);
+
+    // Appends one fragment of an incoming snapshot.
+    void appendInitChunk(QTextDocument* document, const QByteArray& fragment, FormatTable& formats);
+
+    // False if message reaches past the end of document, as it may while a snapshot streams in.
+    bool isReceived(QTextDocument* document, const Message& message);
+}
+
+#endif // DOCUMENTOPS_H
@@ -0,0 +1,91 @@
+#include "editbatcher.h"
+
+#include <algorithm>
+
+EditBatcher::EditBatcher(QObject* parent) :
+    QObject(parent)
+{
+    m_timer.setInterval(15);
+    m_timer.setSingleShot(false);
+    connect(&m_timer, &QTimer::timeout, this, &EditBatcher::timeout);
+}
+
+void EditBatcher::setWindow(int msec)
+{
+    m_timer.setInterval(msec);
+}
+
+void EditBatcher::setMaxChars(int chars)
+{
+    m_maxChars = chars;
+}
+
+void EditBatcher::add(int position, int removed, int added)
+{
+    if (m_hasPending)
+    {
+        const int pending_end = m_position + m_added;
+        if (position <= pending_end && position + removed >= m_position)
+        {
+            const int start = std::min(m_position, position);
+            const int end = std::max(pending_end, position + removed);
+            const int extra = (m_position - start) + (end - pending_end);
+            m_position = start;
+            m_removed += extra;
+            m_added += extra - removed + added;
+        } else
+        {
+            const int offset = position < m_position ? added - removed : 0;
+            m_hasPending = false;
+            emit ready(m_position, m_removed, m_added, offset);
+        }
+    }
+
+    if (!m_hasPending)
+    {
+        if (m_timer.interval() <= 0 || !m_timer.isActive())
+        {
+            if (m_timer.interval() > 0)
+            {
+                m_timer.start();
+            }
+            emit ready(position, removed, added, 0);
+            return;
+        }
+        m_hasPending = true;
+        m_position = position;
+        m_removed = removed;
+        m_added = added;
+    }
+
+    if (m_added >= m_maxChars || m_removed >= m_maxChars)
+    {
+        flush();
+    }
+}
+
+void EditBatcher::flush()
+{
+    if (!m_hasPending)
+    {
+        return;
+    }
+    m_hasPending = false;
+    emit ready(m_position, m_removed, m_added, 0);
+}
+
+bool EditBatcher::hasPending() const
+{
+    return m_hasPending;
+}
+
+void EditBatcher::timeout()
+{
+    if (m_hasPending)
+    {
+        flush();
+    } else
+    {
+        m_timer.stop();
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef EDITBATCHER_H
+#define EDITBATCHER_H
+
+#include <QObject>
+#include <QTimer>
+
+// Coalesces adjacent QTextDocument::contentsChange ranges into one edit.
+// The first change after an idle period is emitted at once, changes arriving
+// within the window after it are merged and emitted when the window closes.
+class EditBatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EditBatcher(QObject* parent = nullptr);
+
+    void setWindow(int msec);
+
+    void setMaxChars(int chars);
+
+    void add(int position, int removed, int added);
+
+    void flush();
+
+    bool hasPending() const;
+
+signals:
+    // Old text [position, position + removed) became [position, position + added).
+    // offset is how far that range has since moved in the current document.
+    void ready(int position, int removed, int added, int offset);
+
+private slots:
+    void timeout();
+
+private:
+    QTimer m_timer;
+    int m_maxChars = 1024;
+
+    bool m_hasPending = false;
+    int m_position = 0;
+    int m_removed = 0;
+    int m_added = 0;
+};
+
+#endif // EDITBATCHER_H
@@ -0,0 +1,157 @@
+#include "framing.h"
+
+#include <QtEndian>
+#include <QDebug>
+
+namespace
+{
+    QByteArray packFrame(const char* payload, int size, quint32 flags, quint64 version)
+    {
+        const bool versioned = flags & Framing::kVersionedFlag;
+        QByteArray frame;
+        frame.reserve(Framing::kHeaderSize + (versioned ? Framing::kVersionSize : 0) + size);
+        char header[Framing::kHeaderSize + Framing::kVersionSize];
+        qToBigEndian<quint32>(quint32(size) | flags, header);
+        if (versioned)
+        {
+            qToBigEndian<quint64>(version, header + Framing::kHeaderSize);
+        }
+        frame.append(header, Framing::kHeaderSize + (versioned ? Framing::kVersionSize : 0));
+        frame.append(payload, size);
+        return frame;
+    }
+
+    int headerSize(quint32 header)
+    {
+        return Framing::kHeaderSize + ((header & Framing::kVersionedFlag) ? Framing::kVersionSize : 0);
+    }
+}
+
+QByteArray Framing::pack(const QByteArray &payload)
+{
+    return packFrame(payload.constData(), payload.size(), 0, 0);
+}
+
+QByteArray Framing::pack(const QByteArray &payload, quint64 version)
+{
+    return packFrame(payload.constData(), payload.size(), kVersionedFlag, version);
+}
+
+quint64 Framing::version(const QByteArray &frame)
+{
+    if (frame.size() < kHeaderSize + kVersionSize || !(qFromBigEndian<quint32>(frame.constData()) & kVersionedFlag))
+    {
+        return kNoVersion;
+    }
+    return qFromBigEndian<quint64>(frame.constData() + kHeaderSize);
+}
+
+bool Framing::isAck(const QByteArray &frame)
+{
+    return frame.size() == kHeaderSize + kVersionSize && version(frame) != kNoVersion;
+}
+
+QByteArray Framing::compress(const QByteArray &frame, int threshold)
+{
+    const quint32 header = qFromBigEndian<quint32>(frame.constData());
+    const int offset = headerSize(header);
+    const int size = frame.size() - offset;
+    if (threshold <= 0 || size < threshold || (header & kCompressedFlag))
+    {
+        return frame;
+    }
+    const QByteArray compressed = qCompress(reinterpret_cast<const uchar*>(frame.constData() + offset), size);
+    if (compressed.size() >= size)
+    {
+        return frame;
+    }
+    return packFrame(compressed.constData(), compressed.size(), (header & kVersionedFlag) | kCompressedFlag, version(frame));
+}
+
+void FrameReader::append(const QByteArray &data)
+{
+    if (m_corrupt)
+    {
+        return;
+    }
+    if (m_offset > 0)
+    {
+        m_buffer.remove(0, m_offset);
+        m_offset = 0;
+    }
+    if (m_buffer.isEmpty())
+    {
+        m_buffer = data;
+    } else
+    {
+        m_buffer.append(data);
+    }
+}
+
+bool FrameReader::next(QByteArray &payload, quint64* version)
+{
+    for (;;)
+    {
+        const int available = m_buffer.size() - m_offset;
+        if (available < Framing::kHeaderSize)
+        {
+            return false;
+        }
+        const quint32 header = qFromBigEndian<quint32>(m_buffer.constData() + m_offset);
+        const bool compressed = header & Framing::kCompressedFlag;
+        const quint32 size = header & Framing::kSizeMask;
+        const int header_size = headerSize(header);
+        if (size > quint32(Framing::kMaxPayloadSize))
+        {
+            qDebug() << __FUNCTION__ << "frame too large:" << size;
+            clear();
+            m_corrupt = true;
+            return false;
+        }
+        if (available < header_size || quint32(available - header_size) < size)
+        {
+            return false;
+        }
+        if (version)
+        {
+            *version = (header & Framing::kVersionedFlag)
+                    ? qFromBigEndian<quint64>(m_buffer.constData() + m_offset + Framing::kHeaderSize)
+                    : Framing::kNoVersion;
+        }
+        const char* data = m_buffer.constData() + m_offset + header_size;
+        m_offset += header_size + int(size);
+        if (!compressed)
+        {
+            payload = QByteArray::fromRawData(data, int(size));
+            return true;
+        }
+
+        // qCompress output starts with the big-endian uncompressed size.
+        if (size >= 4 && qFromBigEndian<quint32>(data) <= quint32(Framing::kMaxPayloadSize))
+        {
+            payload = qUncompress(reinterpret_cast<const uchar*>(data), int(size));
+            if (!payload.isEmpty())
+            {
+                return true;
+            }
+        }
+        qDebug() << __FUNCTION__ << "dropping undecodable compressed frame of" << size << "bytes";
+    }
+}
+
+bool FrameReader::corrupt() const
+{
+    return m_corrupt;
+}
+
+void FrameReader::clear()
+{
+    m_buffer.clear();
+    m_offset = 0;
+    m_corrupt = false;
+}
+
+int FrameReader::pendingBytes() const
+{
+    return m_buffer.size() - m_offset;
+}
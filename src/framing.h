@@ -0,0 +1,61 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <QByteArray>
+
+// Wire format: every message is a 4-byte big-endian header, an optional 8-byte big-endian
+// version and the payload. The low 30 bits of the header are the payload length.
+// Bit 31 marks a payload compressed with qCompress, which peers only send once the other
+// side has said it reads them. Bit 30 marks a frame carrying the host's version for the op
+// (see SessionLog); a versioned frame with an empty payload acknowledges the receiver's own op.
+namespace Framing
+{
+    const int kHeaderSize = 4;
+    const int kVersionSize = 8;
+    const int kMaxPayloadSize = 256 * 1024 * 1024;
+    const quint32 kCompressedFlag = 0x80000000u;
+    const quint32 kVersionedFlag = 0x40000000u;
+    const quint32 kSizeMask = 0x3fffffffu;
+    const quint64 kNoVersion = ~quint64(0);
+    const int kDefaultCompressThreshold = 4096;
+
+    QByteArray pack(const QByteArray& payload);
+
+    QByteArray pack(const QByteArray& payload, quint64 version);
+
+    // The version a packed frame carries, or kNoVersion.
+    quint64 version(const QByteArray& frame);
+
+    // A versioned frame with an empty payload.
+    bool isAck(const QByteArray& frame);
+
+    // Returns frame re-packed with a compressed payload if it is at least threshold bytes
+    // and compression actually makes it smaller; otherwise returns frame unchanged.
+    QByteArray compress(const QByteArray& frame, int threshold);
+}
+
+// Incremental reassembly buffer, one per socket.
+// Payloads returned by next() point into the internal buffer and stay valid until the next append().
+class FrameReader
+{
+public:
+    void append(const QByteArray& data);
+
+    // False until a whole frame is buffered, and for good once the stream is corrupt.
+    bool next(QByteArray& payload, quint64* version = nullptr);
+
+    // A frame claimed more than kMaxPayloadSize. Nothing after it can be framed, so the
+    // owner should drop the connection.
+    bool corrupt() const;
+
+    void clear();
+
+    int pendingBytes() const;
+
+private:
+    QByteArray m_buffer;
+    int m_offset = 0;
+    bool m_corrupt = false;
+};
+
+#endif // FRAMING_H
@@ -0,0 +1,161 @@
+#include "hub.h"
+
+#include <QDebug>
+
+#include <sys/resource.h>
+
+Hub::Hub(const QString &name, const QString &codec, const QString &transport, int compress_threshold, QObject *parent) :
+    QObject(parent),
+    m_transport(Transport::create(transport)),
+    m_name(name),
+    m_codec(codec),
+    m_compressThreshold(compress_threshold)
+{
+    m_transport->setParent(this);
+    if (m_codec == "binary")
+    {
+        m_deserializer.reset(new BinaryDeserializer);
+    } else
+    {
+        m_deserializer.reset(new JsonDeserializer);
+    }
+    connect(m_transport, &Transport::newConnection, this, &Hub::newConnection);
+}
+
+Hub::~Hub()
+{
+    qDeleteAll(m_sessions);
+}
+
+bool Hub::start()
+{
+    if (!m_transport->listen(m_name))
+    {
+        qDebug() << __FUNCTION__ << m_transport->errorString();
+        return false;
+    }
+    return true;
+}
+
+void Hub::stop()
+{
+    m_transport->close();
+    for (auto session : m_sessions)
+    {
+        session->stop();
+    }
+    qDeleteAll(m_sessions);
+    m_sessions.clear();
+}
+
+int Hub::sessionCount() const
+{
+    return m_sessions.size();
+}
+
+int Hub::peerCount() const
+{
+    int count = 0;
+    for (auto session : m_sessions)
+    {
+        count += session->peerCount();
+    }
+    return count;
+}
+
+void Hub::raiseFileLimit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+void Hub::newConnection()
+{
+    while (m_transport->hasPendingConnections())
+    {
+        Connection* socket = m_transport->nextPendingConnection();
+        socket->setParent(this);
+        connect(socket, &Connection::readyRead, this, &Hub::readyRead);
+        connect(socket, &Connection::disconnected, this, &Hub::dropPending);
+        m_pending.insert(socket, QSharedPointer<FrameReader>(new FrameReader));
+    }
+}
+
+// Whatever the peer sent after its hello stays in the reader for the session to handle.
+void Hub::readyRead()
+{
+    Connection* socket = (Connection*) sender();
+    QSharedPointer<FrameReader> reader = m_pending.value(socket);
+    if (reader.isNull())
+    {
+        return;
+    }
+    reader->append(socket->device()->readAll());
+    QByteArray payload;
+    if (!reader->next(payload))
+    {
+        if (reader->corrupt())
+        {
+            m_pending.remove(socket);
+            socket->abort();
+            socket->deleteLater();
+        }
+        return;
+    }
+    m_pending.remove(socket);
+    socket->disconnect(this);
+
+    Message hello;
+    if (!m_deserializer->ProcessOne(payload, hello) || hello.type != kHello)
+    {
+        qDebug() << __FUNCTION__ << "expected a hello, got" << payload.size() << "bytes";
+        socket->abort();
+        socket->deleteLater();
+        return;
+    }
+    sessionFor(hello.hello.session)->addPeer(socket, reader, payload);
+}
+
+void Hub::dropPending()
+{
+    Connection* socket = (Connection*) sender();
+    if (m_pending.remove(socket))
+    {
+        socket->deleteLater();
+    }
+}
+
+void Hub::sessionDeserted()
+{
+    NetworkWorker* session = (NetworkWorker*) sender();
+    qDebug() << __FUNCTION__ << session->name();
+    m_sessions.remove(session->name());
+    session->deleteLater();
+}
+
+NetworkWorker* Hub::sessionFor(const QString &name)
+{
+    const QString session_name = name.isEmpty() ? QString("default") : name;
+    NetworkWorker* session = m_sessions.value(session_name);
+    if (session)
+    {
+        return session;
+    }
+    if (m_codec == "binary")
+    {
+        session = new NetworkWorker(session_name, new BinarySerializer, new BinaryDeserializer, m_transport);
+    } else
+    {
+        session = new NetworkWorker(session_name, new JsonSerializer, new JsonDeserializer, m_transport);
+    }
+    session->setCompressThreshold(m_compressThreshold);
+    session->startHubSession();
+    connect(session, &NetworkWorker::deserted, this, &Hub::sessionDeserted);
+    m_sessions.insert(session_name, session);
+    qDebug() << __FUNCTION__ << session_name << m_sessions.size() << "sessions";
+    return session;
+}
@@ -0,0 +1,63 @@
+#ifndef HUB_H
+#define HUB_H
+
+#include <QObject>
+#include <QHash>
+#include <QSharedPointer>
+#include <QScopedPointer>
+
+#include "serialization.h"
+#include "framing.h"
+#include "networkworker.h"
+#include "transport.h"
+
+// Many named sessions behind one listening socket. A connection is routed by the session
+// named in its kHello to that session's NetworkWorker, which keeps the session's peers and
+// document state; a session is created on its first join and torn down on its last leave.
+class Hub : public QObject
+{
+    Q_OBJECT
+public:
+    Hub(const QString& name, const QString& codec, const QString& transport, int compress_threshold, QObject* parent = nullptr);
+
+    ~Hub();
+
+    bool start();
+
+    // Hands every session over to one of its peers.
+    void stop();
+
+    int sessionCount() const;
+
+    int peerCount() const;
+
+    // Every peer costs the hub a descriptor; the default soft limit stops at about a thousand.
+    static void raiseFileLimit();
+
+private slots:
+    void newConnection();
+
+    void readyRead();
+
+    void dropPending();
+
+    void sessionDeserted();
+
+private:
+    NetworkWorker* sessionFor(const QString& name);
+
+private:
+    // A child, shared by every session; it carries their broadcast channels.
+    Transport* m_transport;
+    QString m_name;
+    QString m_codec;
+    int m_compressThreshold;
+
+    QScopedPointer<IDeserializer> m_deserializer;
+
+    // Connections that have not said which session they join yet.
+    QHash<Connection*, QSharedPointer<FrameReader>> m_pending;
+    QHash<QString, NetworkWorker*> m_sessions;
+};
+
+#endif // HUB_H
@@ -1,314 +1,295 @@
 #include "localserver.h"
+#include "documentops.h"
+#include "tracing.h"
 
-#include <QTextDocumentFragment>
-#include <QTextBlock>
+#include <QElapsedTimer>
 
-const QString LocalServer::MessageField::TYPE = "type";
-const QString LocalServer::MessageField::POSITION = "position";
-const QString LocalServer::MessageField::REMOVED = "removed";
-const QString LocalServer::MessageField::ADDED = "added";
-const QString LocalServer::MessageField::VALUE = "value";
-const QString LocalServer::MessageField::BOLD = "bold";
-const QString LocalServer::MessageField::UNDERLINE = "underline";
-const QString LocalServer::MessageField::ITALIC = "italic";
-const QString LocalServer::MessageField::FAMILY = "family";
-const QString LocalServer::MessageField::SIZE = "size";
-const QString LocalServer::MessageField::COLOR = "color";
-
-const QString LocalServer::MessageValue::NONE = "none";
-
-LocalServer::LocalServer(TextEdit& text_edit, const QString& name, ISerializer* serializer, IDeserializer* deserializer, QObject* parent)  :
+LocalServer::LocalServer(TextEdit& text_edit, const QString& name, ISerializer* serializer, IDeserializer* deserializer, Transport* transport, QObject* parent)  :
     QObject(parent),
     m_textEdit(text_edit),
-    m_name(name.isEmpty() ? "default" : name),
-    m_serializer(serializer),
-    m_deserializer(deserializer)
+    m_worker(new NetworkWorker(name, serializer, deserializer, transport))
 {
-    connect(&m_server, &QLocalServer::newConnection, this, &LocalServer::newConnection);
-    if (m_server.listen(m_name))
-    {
-        m_serverMode = true;
-        connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-        connect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged);
-    } else
-    {
-        qDebug() << m_server.errorString();
-        connect(&m_socket, &QLocalSocket::errorOccurred, this, &LocalServer::socketError);
-        connect(&m_socket, &QLocalSocket::readyRead, this, &LocalServer::readyRead);
-        m_socket.connectToServer(m_name);
-    }
+    connect(&m_batcher, &EditBatcher::ready, this, &LocalServer::sendContentChange);
+    connect(m_worker.data(), &NetworkWorker::opsAvailable, this, &LocalServer::drainInbound);
+    connect(m_worker.data(), &NetworkWorker::hosting, this, &LocalServer::startHosting);
+    m_worker->moveToThread(&m_thread);
+    m_thread.setObjectName("network");
+    m_thread.start();
+    QMetaObject::invokeMethod(m_worker.data(), "start", Qt::QueuedConnection);
 }
 
 LocalServer::~LocalServer()
 {
     disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
     disconnect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged);
-    if (m_serverMode)
-    {
-        m_server.close();
-        if (!m_sockets.isEmpty())
-        {
-            passServerRole();
-        }
-    }
+    disconnect(&m_textEdit, &TextEdit::charFormatChanged, this, &LocalServer::charFormatChanged);
+    m_batcher.flush();
+    QMetaObject::invokeMethod(m_worker.data(), "stop", Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
 }
 
-void LocalServer::newConnection()
+void LocalServer::setBatchWindow(int msec)
 {
-    while (m_server.hasPendingConnections())
-    {
-        QLocalSocket* socket = m_server.nextPendingConnection();
-        connect(socket, &QLocalSocket::readyRead, this, &LocalServer::readyRead);
-        connect(socket, &QLocalSocket::errorOccurred, this, &LocalServer::socketError);
-        connect(socket, &QLocalSocket::disconnected, this, &LocalServer::disconnectFromServer);
-        m_sockets.push_back(socket);
-        sendBodyToNewbie();
-    }
+    m_batcher.setWindow(msec);
+}
+
+void LocalServer::setBatchSize(int chars)
+{
+    m_batcher.setMaxChars(chars);
 }
 
-void LocalServer::readyRead()
+void LocalServer::setCompressThreshold(int bytes)
 {
-    QLocalSocket* editing_socket = (QLocalSocket*) sender();
-    QByteArray data = editing_socket->readAll();
-    handleMessage(editing_socket, data);
+    NetworkWorker* worker = m_worker.data();
+    QMetaObject::invokeMethod(worker, [worker, bytes]() { worker->setCompressThreshold(bytes); }, Qt::QueuedConnection);
 }
 
-void LocalServer::socketError()
+void LocalServer::startHosting()
 {
-    QLocalSocket* socket = (QLocalSocket*) sender();
-    qDebug() << __FUNCTION__ << socket->errorString() << " " << socket->state();
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange, Qt::UniqueConnection);
+    connect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged, Qt::UniqueConnection);
+    connect(&m_textEdit, &TextEdit::charFormatChanged, this, &LocalServer::charFormatChanged, Qt::UniqueConnection);
 }
 
-void LocalServer::disconnectFromServer()
+void LocalServer::drainInbound()
 {
-    QLocalSocket* sender_socket = (QLocalSocket*) sender();
-    for (auto& socket : m_sockets)
+    m_worker->rearm();
+    InboundOp op;
+    while (m_worker->takeInbound(op))
     {
-        if (sender_socket == socket)
+        m_batcher.flush();
+        if (op.kind == InboundOp::kSnapshotRequest)
+        {
+            // The first joiner of a hub session is asked for its document instead of sent
+            // one; its edits count from the snapshot on, as a host's do.
+            startHosting();
+            TraceSpan span("snapshot");
+            const QList<Message> snapshot = takeSnapshot();
+            NetworkWorker* worker = m_worker.data();
+            QMetaObject::invokeMethod(worker, [worker, snapshot]() { worker->setSnapshot(snapshot); }, Qt::QueuedConnection);
+        } else
         {
-            m_sockets.removeOne(sender_socket);
-            sender_socket->deleteLater();
+            TraceSpan span("apply", op.message.trace);
+            if (Tracing::enabled())
+            {
+                span.setDetail(Metrics::typeName(op.message.type));
+                Tracing::applied(op.message.trace);
+            }
+            QElapsedTimer timer;
+            timer.start();
+            handleMessage(op.message);
+            m_worker->metrics().applied(timer.nsecsElapsed());
+        }
+        // One piece of a streamed document per turn, so the first screenful paints
+        // while the rest is applied.
+        if (op.kind == InboundOp::kMessage && (op.message.type == kInit || op.message.type == kInitChunk) && m_initChunksLeft > 0)
+        {
+            QMetaObject::invokeMethod(this, "drainInbound", Qt::QueuedConnection);
+            return;
         }
     }
 }
 
-void LocalServer::styleChanged(int style_index, int position)
+void LocalServer::styleChanged(int position, int length)
 {
-    QVariantMap map;
-    map[MessageField::TYPE] = kStyleChanged;
-    map[MessageField::POSITION] = position;
-    map[MessageField::VALUE] = style_index;
-    sendData(m_serializer->Process(map));
+    m_batcher.flush();
+    sendData(DocumentOps::styleChange(m_textEdit.document(), position, length));
 }
 
-void LocalServer::handleMessage(QLocalSocket* editing_socket, const QByteArray &message)
+void LocalServer::charFormatChanged(int position, int length, const QTextCharFormat& format)
 {
-    QList<QVariantMap> maps = m_deserializer->Process(message);
-    if (maps.isEmpty())
+    m_batcher.flush();
+    const Message message = DocumentOps::charFormatChange(position, length, format);
+    if (message.format.properties == 0)
     {
         return;
     }
-    bool send_out = false;
-    for (auto& map : maps)
+    sendData(message);
+}
+
+void LocalServer::handleMessage(const Message &message)
+{
+    switch (message.type)
     {
-        int type = map[MessageField::TYPE].toInt();
-        switch (type)
+        case MessageType::kInit:
         {
-            case MessageType::kInit:
-            {
-                handleInitMessage(map[MessageField::VALUE].toString());
-                break;
-            }
-            case MessageType::kContentChangedWithHtml:
-            {
-                changeContentWithHtml(map);
-                send_out = true;
-                break;
-            }
-            case MessageType::kRunServer:
-            {
-                handleRunServerMessage();
-                break;
-            }
-            case MessageType::kServerDown:
-            {
-                handleServerDownMessage();
-                break;
-            }
-            case MessageType::kStyleChanged:
-            {
-                changeContentStyle(map);
-                send_out = true;
-                break;
-            }
-            case MessageType::kReset:
-            {
-                send_out = true;
-                disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-                m_textEdit.loadExternalData(map[MessageField::ADDED].toString() == MessageValue::NONE ? QString() : map[MessageField::ADDED].toString());
-                connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-                break;
-            }
+            handleInitMessage(message.init);
+            return;
         }
-    }
-    if (send_out && m_serverMode)
-    {
-        for (auto& socket : m_sockets)
+        case MessageType::kInitChunk:
         {
-            if (socket != editing_socket)
-            {
-                socket->write(message);
-            }
+            handleInitChunk(message.init);
+            return;
         }
+        default:
+            break;
+    }
+
+    // While the initial state is still streaming in, edits beyond the received part
+    // (and everything after the first such edit) wait for the remaining chunks.
+    if (m_initChunksLeft > 0 && (!m_pendingOps.isEmpty() || !isReceived(message)))
+    {
+        m_pendingOps.push_back(message);
+    } else
+    {
+        applyMessage(message);
     }
 }
 
-void LocalServer::handleInitMessage(const QString &init_data)
+void LocalServer::applyMessage(const Message &message)
 {
-    m_textEdit.loadExternalData(init_data == MessageValue::NONE ? QString() : init_data);
-    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-    connect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged);
+    switch (message.type)
+    {
+        case MessageType::kContentChangedWithHtml:
+            changeContentWithHtml(message.content);
+            break;
+        case MessageType::kContentChangedWithPlain:
+            changeContentWithPlain(message.content);
+            break;
+        case MessageType::kContentChangedWithFragment:
+            changeContentWithFragment(message.content);
+            break;
+        case MessageType::kStyleChanged:
+            changeContentStyle(message.style);
+            break;
+        case MessageType::kCharFormatChanged:
+            changeCharFormat(message.format);
+            break;
+        case MessageType::kReset:
+            handleResetMessage(message.reset);
+            break;
+        default:
+            break;
+    }
 }
 
-void LocalServer::handleRunServerMessage()
+bool LocalServer::isReceived(const Message &message)
 {
-    while (!m_server.listen(m_name)) {}
-    m_serverMode = true;
+    return DocumentOps::isReceived(m_textEdit.document(), message);
 }
 
-void LocalServer::handleServerDownMessage()
+void LocalServer::handleInitMessage(const InitMessage &message)
 {
-    if (m_socket.state() == QLocalSocket::ConnectedState)
+    m_formats.load(message.formats);
+    m_pendingOps.clear();
+    m_initChunksLeft = 0;
+    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    if (!message.html.isEmpty())
     {
-        m_socket.disconnectFromServer();
-    }
-    do
+        m_textEdit.loadExternalData(message.html);
+    } else
     {
-        m_socket.connectToServer(m_name);
-    } while (!m_socket.waitForConnected());
-}
-
-void LocalServer::changeContentStyle(const QVariantMap &map)
-{
-    disconnect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged);
-    QTextCursor cursor(m_textEdit.document());
-    cursor.setPosition(map[MessageField::POSITION].toInt());
-    m_textEdit.externalSetTextStyleByIndex(map[MessageField::VALUE].toInt());
-    connect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged);
+        m_textEdit.loadExternalData(QString());
+        if (!message.fragment.isEmpty())
+        {
+            appendInitChunk(message.fragment);
+        }
+        m_initChunksLeft = message.chunks - 1;
+    }
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange, Qt::UniqueConnection);
+    connect(&m_textEdit, &TextEdit::styleChanged, this, &LocalServer::styleChanged, Qt::UniqueConnection);
+    connect(&m_textEdit, &TextEdit::charFormatChanged, this, &LocalServer::charFormatChanged, Qt::UniqueConnection);
 }
 
-void LocalServer::passServerRole()
+void LocalServer::handleInitChunk(const InitMessage &message)
 {
-    QLocalSocket* socket = m_sockets.first();
-
-    QVariantMap map;
-    map[MessageField::TYPE] = kRunServer;
-
-    socket->write(m_serializer->Process(map));
-    socket->flush();
-
-    map[MessageField::TYPE] = kServerDown;
-
-    QByteArray down_message = m_serializer->Process(map);
-
-    for (int i = 1; i < m_sockets.size(); ++i)
+    if (m_initChunksLeft <= 0)
     {
-        m_sockets[i]->write(down_message);
-        m_sockets[i]->flush();
+        return;
     }
-    for (auto& socket : m_sockets)
+    appendInitChunk(message.fragment);
+    if (--m_initChunksLeft == 0)
     {
-        delete socket;
+        QList<Message> pending;
+        pending.swap(m_pendingOps);
+        for (auto& op : pending)
+        {
+            applyMessage(op);
+        }
     }
 }
 
-void LocalServer::sendBodyToNewbie()
+void LocalServer::appendInitChunk(const QByteArray &fragment)
 {
-    QLocalSocket* socket = m_sockets.back();
-    QVariantMap map;
-    map[MessageField::TYPE] = kInit;
     disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-    map[MessageField::VALUE] = m_textEdit.document()->isEmpty() ? MessageValue::NONE : m_textEdit.document()->toHtml();
+    DocumentOps::appendInitChunk(m_textEdit.document(), fragment, m_formats);
     connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-    socket->write(m_serializer->Process(map));
 }
 
-void LocalServer::changeContentWithHtml(const QVariantMap& map)
+void LocalServer::handleResetMessage(const ResetMessage &message)
 {
-    int position = map[MessageField::POSITION].toInt();
-    int removed = map[MessageField::REMOVED].toInt();
-    QString added = map[MessageField::ADDED].toString();
-
     disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    m_textEdit.loadExternalData(message.html);
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+}
 
-    QTextCursor cursor(m_textEdit.document());
-    cursor.setPosition(position);
+void LocalServer::changeContentStyle(const StyleChangedMessage &message)
+{
+    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    DocumentOps::changeContentStyle(m_textEdit.document(), message);
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+}
 
-    cursor.beginEditBlock();
+QList<Message> LocalServer::takeSnapshot()
+{
+    return DocumentOps::snapshot(m_textEdit.document(), m_formats);
+}
 
-    for (int i = 0; i < removed; ++i)
-    {
-        cursor.deleteChar();
-    }
+void LocalServer::changeContentWithHtml(const ContentChangedMessage& message)
+{
+    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    DocumentOps::changeContentWithHtml(m_textEdit.document(), message);
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+}
 
-    if (added != MessageValue::NONE)
-    {
-        cursor.insertFragment(QTextDocumentFragment::fromHtml(added));
-    }
+void LocalServer::changeContentWithPlain(const ContentChangedMessage& message)
+{
+    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    DocumentOps::changeContentWithPlain(m_textEdit.document(), message);
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+}
 
-    cursor.endEditBlock();
+void LocalServer::changeContentWithFragment(const ContentChangedMessage& message)
+{
+    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    DocumentOps::changeContentWithFragment(m_textEdit.document(), message, m_formats);
+    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+}
 
+void LocalServer::changeCharFormat(const CharFormatMessage& message)
+{
+    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
+    DocumentOps::changeCharFormat(m_textEdit.document(), message);
     connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
 }
 
-void LocalServer::sendData(const QByteArray &data)
+void LocalServer::sendData(Message message)
 {
-    if (m_serverMode)
-    {
-        for (auto& socket : m_sockets)
-        {
-            socket->write(data);
-            socket->flush();
-        }
-    } else
+    if (message.trace == 0 && Tracing::enabled())
     {
-        m_socket.write(data);
-        m_socket.flush();
+        message.trace = Tracing::nextOp();
     }
+    NetworkWorker* worker = m_worker.data();
+    QMetaObject::invokeMethod(worker, [worker, message]() { worker->send(message); }, Qt::QueuedConnection);
 }
 
+// Every change the batcher merges into one op shares its trace id.
 void LocalServer::contentsChange(int position, int charRemoved, int charAdded)
 {
-    QString added_text = MessageValue::NONE;
-    QVariantMap map;
-    disconnect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-    QTextCursor cursor(m_textEdit.document());
-    cursor.setPosition(position);
-    int style = m_textEdit.getStyle();
-    if (style != 0)
-    {
-        map[MessageField::TYPE] = kReset;
-        added_text =  charAdded ? m_textEdit.document()->toHtml() : added_text;
-    } else
+    if (m_traceOp == 0 && Tracing::enabled())
     {
-        map[MessageField::TYPE] = kContentChangedWithHtml;
-        map[MessageField::POSITION] = position;
-        map[MessageField::REMOVED] = charRemoved;
-        if (charAdded)
-        {
-            cursor.setPosition(position + charAdded, QTextCursor::KeepAnchor);
-            added_text = cursor.selection().toHtml();
-        }
+        m_traceOp = Tracing::nextOp();
     }
+    TraceSpan span("contentsChange", m_traceOp);
+    m_batcher.add(position, charRemoved, charAdded);
+}
 
-    if (added_text.isEmpty())
-    {
-        connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-        return;
-    }
-
-    connect(&m_textEdit, &TextEdit::contentsChange, this, &LocalServer::contentsChange);
-
-    map[MessageField::ADDED] = added_text;
-    sendData(m_serializer->Process(map));
+void LocalServer::sendContentChange(int position, int charRemoved, int charAdded, int offset)
+{
+    TraceSpan span("serialize", m_traceOp);
+    Message message = DocumentOps::contentChange(m_textEdit.document(), position, charRemoved, charAdded, offset, m_formats);
+    message.trace = m_traceOp;
+    m_traceOp = 0;
+    sendData(message);
 }
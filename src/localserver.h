@@ -4,100 +4,93 @@
 #include "textedit.h"
 
 #include <QObject>
-#include <QLocalServer>
-#include <QLocalSocket>
 #include <QTextDocument>
+#include <QThread>
 #include "serialization.h"
+#include "editbatcher.h"
+#include "richfragment.h"
+#include "networkworker.h"
 
-#include <QJsonDocument>
 #include <QTextCursor>
-#include <QEventLoop>
+#include <QScopedPointer>
 
+// The document side of a session, on the GUI thread: turns local edits into ops and
+// applies decoded remote ops. Sockets, framing and the codec run on a NetworkWorker
+// in a thread of its own.
 class LocalServer : public QObject
 {
     Q_OBJECT
 public: 
-    enum MessageType
-    {
-        kInit,
-        kContentChangedWithHtml,
-        kRunServer,
-        kServerDown,
-        kStyleChanged,
-        kContentChangedWithPlain,
-        kReset
-    };
-
-    struct MessageField
-    {
-        static const QString TYPE;
-        static const QString POSITION;
-        static const QString REMOVED;
-        static const QString ADDED;
-        static const QString VALUE;
-        static const QString BOLD;
-        static const QString UNDERLINE;
-        static const QString ITALIC;
-        static const QString FAMILY;
-        static const QString SIZE;
-        static const QString COLOR;
-    };
-
-    struct MessageValue
-    {
-        static const QString NONE;
-    };
-
-    LocalServer(TextEdit& text_edit, const QString& name, ISerializer* serializer, IDeserializer* deserializer, QObject* parent = nullptr);
+    LocalServer(TextEdit& text_edit, const QString& name, ISerializer* serializer, IDeserializer* deserializer, Transport* transport, QObject* parent = nullptr);
 
     ~LocalServer();
 
+    void setBatchWindow(int msec);
+
+    void setBatchSize(int chars);
+
+    void setCompressThreshold(int bytes);
+
 private slots:
     void contentsChange(int position, int charRemoved, int charAdded);
 
-    void newConnection();
+    void styleChanged(int position, int length);
 
-    void readyRead();
+    void sendContentChange(int position, int charRemoved, int charAdded, int offset);
 
-    void socketError();
+    void charFormatChanged(int position, int length, const QTextCharFormat& format);
 
-    void disconnectFromServer();
+    void drainInbound();
 
-    void styleChanged(int style_index, int position);
+    void startHosting();
 
 private:
+    void handleMessage(const Message& message);
 
-    void handleMessage(QLocalSocket* editing_socket, const QByteArray& message);
+    void handleInitMessage(const InitMessage& message);
 
-    void handleInitMessage(const QString& init_data);
+    void handleInitChunk(const InitMessage& message);
 
-    void handleRunServerMessage();
+    void appendInitChunk(const QByteArray& fragment);
 
-    void handleServerDownMessage();
+    bool isReceived(const Message& message);
 
-    void changeContentStyle(const QVariantMap& data);
+    void applyMessage(const Message& message);
 
-    void changeContentWithHtml(const QVariantMap& data);
+    void handleResetMessage(const ResetMessage& message);
 
-    void sendData(const QByteArray& data);
+    void changeContentStyle(const StyleChangedMessage& message);
 
-    void passServerRole();
+    void changeContentWithHtml(const ContentChangedMessage& message);
 
-    void sendBodyToNewbie();
+    void changeContentWithPlain(const ContentChangedMessage& message);
 
-private:
-    QLocalServer m_server;
-    QLocalSocket m_socket;
+    void changeContentWithFragment(const ContentChangedMessage& message);
+
+    void changeCharFormat(const CharFormatMessage& message);
 
-    QList<QLocalSocket*> m_sockets;
+    void sendData(Message message);
 
+    QList<Message> takeSnapshot();
+
+    // textedit_bench times the steps above directly and reads the worker's counters.
+    friend class EditorBench;
+    friend class FailoverPeer;
+
+private:
     TextEdit& m_textEdit;
-    QString m_name;
 
-    QScopedPointer<ISerializer> m_serializer;
-    QScopedPointer<IDeserializer> m_deserializer;
+    QThread m_thread;
+    QScopedPointer<NetworkWorker> m_worker;
+
+    EditBatcher m_batcher;
+    FormatTable m_formats;
+
+    int m_initChunksLeft = 0;
+    QList<Message> m_pendingOps;
 
-    bool m_serverMode = false;
+    // The trace id of the op the batcher is collecting, while tracing.
+    quint64 m_traceOp = 0;
 };
 
 #endif // LOCALSERVER_H
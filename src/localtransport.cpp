@@ -0,0 +1,100 @@
+#include "localtransport.h"
+
+LocalConnection::LocalConnection(QLocalSocket *socket, QObject *parent) :
+    Connection(parent),
+    m_socket(socket ? socket : new QLocalSocket)
+{
+    m_socket->setParent(this);
+    connect(m_socket, &QLocalSocket::connected, this, &Connection::connected);
+    connect(m_socket, &QLocalSocket::disconnected, this, &Connection::disconnected);
+    connect(m_socket, &QLocalSocket::readyRead, this, &Connection::readyRead);
+    connect(m_socket, &QLocalSocket::errorOccurred, this, &Connection::errorOccurred);
+}
+
+QIODevice* LocalConnection::device()
+{
+    return m_socket;
+}
+
+void LocalConnection::connectToServer(const QString &name)
+{
+    m_socket->connectToServer(name);
+}
+
+bool LocalConnection::waitForConnected(int msecs)
+{
+    return m_socket->waitForConnected(msecs);
+}
+
+bool LocalConnection::isConnected() const
+{
+    return m_socket->state() == QLocalSocket::ConnectedState;
+}
+
+void LocalConnection::disconnectFromServer()
+{
+    m_socket->disconnectFromServer();
+}
+
+void LocalConnection::abort()
+{
+    m_socket->abort();
+}
+
+bool LocalConnection::flush()
+{
+    return m_socket->flush();
+}
+
+QString LocalConnection::errorString() const
+{
+    return m_socket->errorString();
+}
+
+LocalTransport::LocalTransport(QObject *parent) :
+    Transport(parent),
+    m_server(this)
+{
+    connect(&m_server, &QLocalServer::newConnection, this, &Transport::newConnection);
+}
+
+bool LocalTransport::listen(const QString &name)
+{
+    return m_server.listen(name);
+}
+
+void LocalTransport::close()
+{
+    m_server.close();
+}
+
+bool LocalTransport::hasPendingConnections() const
+{
+    return m_server.hasPendingConnections();
+}
+
+Connection* LocalTransport::nextPendingConnection()
+{
+    QLocalSocket* socket = m_server.nextPendingConnection();
+    return socket ? new LocalConnection(socket) : nullptr;
+}
+
+Connection* LocalTransport::createConnection(QObject *parent)
+{
+    return new LocalConnection(nullptr, parent);
+}
+
+QString LocalTransport::errorString() const
+{
+    return m_server.errorString();
+}
+
+bool LocalTransport::addressInUse() const
+{
+    return m_server.serverError() == QAbstractSocket::AddressInUseError;
+}
+
+void LocalTransport::removeStale(const QString &name)
+{
+    QLocalServer::removeServer(name);
+}
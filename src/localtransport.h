@@ -0,0 +1,63 @@
+#ifndef LOCALTRANSPORT_H
+#define LOCALTRANSPORT_H
+
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include "transport.h"
+
+class LocalConnection : public Connection
+{
+    Q_OBJECT
+public:
+    // Takes over socket, or creates one if it is null.
+    explicit LocalConnection(QLocalSocket* socket = nullptr, QObject* parent = nullptr);
+
+    QIODevice* device() override;
+
+    void connectToServer(const QString& name) override;
+
+    bool waitForConnected(int msecs) override;
+
+    bool isConnected() const override;
+
+    void disconnectFromServer() override;
+
+    void abort() override;
+
+    bool flush() override;
+
+    QString errorString() const override;
+
+private:
+    QLocalSocket* m_socket;
+};
+
+// Unix domain sockets, named after the session.
+class LocalTransport : public Transport
+{
+    Q_OBJECT
+public:
+    explicit LocalTransport(QObject* parent = nullptr);
+
+    bool listen(const QString& name) override;
+
+    void close() override;
+
+    bool hasPendingConnections() const override;
+
+    Connection* nextPendingConnection() override;
+
+    Connection* createConnection(QObject* parent) override;
+
+    QString errorString() const override;
+
+    bool addressInUse() const override;
+
+    void removeStale(const QString& name) override;
+
+private:
+    QLocalServer m_server;
+};
+
+#endif // LOCALTRANSPORT_H
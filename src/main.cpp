@@ -50,6 +50,8 @@
 
 #include "textedit.h"
 #include "localserver.h"
+#include "hub.h"
+#include "tracing.h"
 
 #include <signal.h>
 
@@ -79,12 +81,56 @@ void catchUnixSignals(std::initializer_list<int> quitSignals) {
 
 }
 
+// The application object has to be picked before the command line is parsed.
+bool isHubMode(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (qstrcmp(argv[i], "--hub") == 0)
+            return true;
+    }
+    return false;
+}
+
+int runHub(const QString &codec, const QString &transport, int compress_threshold)
+{
+    Hub::raiseFileLimit();
+    Hub hub(NetworkWorker::hubName(), codec, transport, compress_threshold);
+    if (!hub.start())
+    {
+        return 1;
+    }
+    const int code = QCoreApplication::exec();
+    hub.stop();
+    return code;
+}
+
+int runSessionHub(const QString &session_name, const QString &codec, const QString &transport, int compress_threshold)
+{
+    QScopedPointer<NetworkWorker> hub;
+    if (codec == "binary")
+    {
+        hub.reset(new NetworkWorker(session_name, new BinarySerializer, new BinaryDeserializer, Transport::create(transport)));
+    } else
+    {
+        hub.reset(new NetworkWorker(session_name, new JsonSerializer, new JsonDeserializer, Transport::create(transport)));
+    }
+    hub->setCompressThreshold(compress_threshold);
+    if (!hub->startHub())
+    {
+        return 1;
+    }
+    const int code = QCoreApplication::exec();
+    hub->stop();
+    return code;
+}
 
 int main(int argc, char *argv[])
 {
     Q_INIT_RESOURCE(textedit);
 
-    QApplication a(argc, argv);
+    const bool hub_mode = isHubMode(argc, argv);
+    QScopedPointer<QCoreApplication> a(hub_mode ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
     catchUnixSignals({SIGINT, SIGTERM, SIGHUP});
 
     QCoreApplication::setOrganizationName("QtProject");
@@ -99,7 +145,51 @@ int main(int argc, char *argv[])
     parser.addOption(detach_option);
     QCommandLineOption named_session_option({"session", "s"}, "Start named session with <name>", "name");
     parser.addOption(named_session_option);
-    parser.process(a);
+    QCommandLineOption codec_option("codec", "Wire codec: json (default) or binary. All peers of a session must use the same codec.", "codec", "json");
+    parser.addOption(codec_option);
+    QCommandLineOption batch_window_option("batch-window", "Coalesce outgoing edits typed within <msec> (0 disables).", "msec", "15");
+    parser.addOption(batch_window_option);
+    QCommandLineOption batch_size_option("batch-size", "Send a coalesced edit once it reaches <chars>.", "chars", "1024");
+    parser.addOption(batch_size_option);
+    QCommandLineOption compress_threshold_option("compress-threshold", "Compress frames of at least <bytes> when the peer supports it (0 disables).", "bytes", QString::number(Framing::kDefaultCompressThreshold));
+    parser.addOption(compress_threshold_option);
+    QCommandLineOption transport_option("transport", "How peers reach each other: local (default), shm, which also relays ops through a shared-memory ring, or tcp[:host[:port]] (127.0.0.1:7800 by default; sessions without a hub use ports above it). All peers of a session must use the same transport.", "transport", "local");
+    parser.addOption(transport_option);
+    QCommandLineOption hub_option("hub", "Host sessions headless: sequence and relay ops without an editor window. Hosts every session editors join unless --session names one.");
+    parser.addOption(hub_option);
+    QCommandLineOption trace_option("trace", "Append a Chrome trace-event timeline of how edits travel to <file>; TEXTEDIT_TRACE does the same. Every process of a session can share one file.", "file");
+    parser.addOption(trace_option);
+    parser.process(*a);
+
+    const QString trace_file = parser.isSet(trace_option) ? parser.value(trace_option) : qEnvironmentVariable("TEXTEDIT_TRACE");
+    if (!trace_file.isEmpty() && !Tracing::enable(trace_file, hub_mode ? "textedit hub" : "textedit"))
+    {
+        qWarning() << "cannot write trace" << trace_file;
+    }
+
+    const QString codec = parser.value(codec_option);
+    if (codec != "json" && codec != "binary")
+    {
+        qWarning() << "unknown codec" << codec;
+        return 1;
+    }
+
+    const QString transport = parser.value(transport_option);
+    if (QScopedPointer<Transport>(Transport::create(transport)).isNull())
+    {
+        qWarning() << "unknown transport" << transport;
+        return 1;
+    }
+
+    if (hub_mode)
+    {
+        const int compress_threshold = parser.value(compress_threshold_option).toInt();
+        if (parser.isSet(named_session_option))
+        {
+            return runSessionHub(parser.value(named_session_option), codec, transport, compress_threshold);
+        }
+        return runHub(codec, transport, compress_threshold);
+    }
 
     QString file_name = parser.positionalArguments().value(0);
 
@@ -121,10 +211,19 @@ int main(int argc, char *argv[])
     {
         QString session_name = parser.isSet(named_session_option) ? parser.value(named_session_option) : QString("default");
         qDebug() << session_name;
-        server.reset(new LocalServer(mw, session_name, new JsonSerializer, new JsonDeserializer));
+        if (codec == "binary")
+        {
+            server.reset(new LocalServer(mw, session_name, new BinarySerializer, new BinaryDeserializer, Transport::create(transport)));
+        } else
+        {
+            server.reset(new LocalServer(mw, session_name, new JsonSerializer, new JsonDeserializer, Transport::create(transport)));
+        }
+        server->setBatchWindow(parser.value(batch_window_option).toInt());
+        server->setBatchSize(parser.value(batch_size_option).toInt());
+        server->setCompressThreshold(parser.value(compress_threshold_option).toInt());
     }
 
     mw.show();
 
-    return a.exec();
+    return a->exec();
 }
@@ -0,0 +1,145 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+enum MessageType
+{
+    kInit,
+    kContentChangedWithHtml,
+    kRunServer,
+    kServerDown,
+    kStyleChanged,
+    kContentChangedWithPlain,
+    kReset,
+    kContentChangedWithFragment,
+    kCharFormatChanged,
+    kInitChunk,
+    kHello,
+    kSnapshotRequest,
+    kSnapshot
+};
+
+// Optional wire features; a peer only uses one after the other side has advertised it.
+enum Capability
+{
+    kCompression = 0x01,
+    kBroadcast = 0x02
+};
+
+// The initial state of the document, streamed as kInit followed by chunks - 1 kInitChunk
+// messages. Each carries a RichFragment covering the next run of whole blocks. html is
+// only used, as a single chunk, for documents with frames the fragment codec cannot carry.
+struct InitMessage
+{
+    QString html;
+    QByteArray formats;
+    QByteArray fragment;
+    int chunks = 1;
+};
+
+// The first message on every connection, both ways. A peer that already holds the
+// document (after a failover) sets resume and the last version it has seen, and only
+// gets the ops after it instead of kInit. A multi-session hub routes the connection by session.
+// The host's answer names the peer and, if it reads the transport's broadcast channel,
+// the channel and the position to read it from.
+struct HelloMessage
+{
+    int capabilities = 0;
+    bool resume = false;
+    quint64 version = 0;
+    QString session;
+    quint32 peer = 0;
+    QString broadcast;
+    quint64 position = 0;
+};
+
+// Hands the host role to a peer, with the session version and the versioned op frames
+// other peers may still be missing.
+struct RunServerMessage
+{
+    quint64 version = 0;
+    QList<QByteArray> tail;
+};
+
+// Used by kContentChangedWithHtml and kContentChangedWithPlain (added),
+// and by kContentChangedWithFragment (fragment, see RichFragment).
+struct ContentChangedMessage
+{
+    int position = 0;
+    int removed = 0;
+    QString added;
+    QByteArray fragment;
+};
+
+// Paragraph style of every block from the one at position to the one at position + length.
+// Formats are QDataStream-serialized QTextBlockFormat/QTextListFormat; an empty
+// list_format takes the blocks out of any list.
+struct StyleChangedMessage
+{
+    int position = 0;
+    int length = 0;
+    QByteArray block_format;
+    QByteArray list_format;
+};
+
+// Merge of the listed char properties into [position, position + length).
+struct CharFormatMessage
+{
+    enum Property
+    {
+        kBold = 0x01,
+        kUnderline = 0x02,
+        kItalic = 0x04,
+        kFamily = 0x08,
+        kSize = 0x10,
+        kColor = 0x20,
+        kSizeAdjustment = 0x40
+    };
+
+    int position = 0;
+    int length = 0;
+    int properties = 0;
+    bool bold = false;
+    bool underline = false;
+    bool italic = false;
+    QString family;
+    double size = 0;
+    quint32 color = 0;
+    int size_adjustment = 0;
+};
+
+// A peer's answer to kSnapshotRequest from a hub: the serialized kInit and kInitChunk
+// payloads of its document as of the ops it had seen when the request arrived, plus its own.
+// The request itself carries only version, the last op the hub had sequenced when it asked.
+struct SnapshotMessage
+{
+    QList<QByteArray> payloads;
+    quint64 version = 0;
+};
+
+struct ResetMessage
+{
+    QString html;
+};
+
+// Only the member matching type is meaningful; kServerDown carries no payload and
+// kSnapshotRequest uses snapshot.
+struct Message
+{
+    MessageType type = kInit;
+    InitMessage init;
+    ContentChangedMessage content;
+    StyleChangedMessage style;
+    ResetMessage reset;
+    CharFormatMessage format;
+    HelloMessage hello;
+    RunServerMessage run_server;
+    SnapshotMessage snapshot;
+    // The op's id while its sender traces (see Tracing), relayed with it; 0 otherwise.
+    quint64 trace = 0;
+};
+
+#endif // MESSAGES_H
@@ -0,0 +1,204 @@
+#include "metrics.h"
+
+#include <QtAlgorithms>
+
+#include <algorithm>
+
+namespace
+{
+    const char* const kTypeNames[] = {
+        "init",
+        "content_html",
+        "run_server",
+        "server_down",
+        "style",
+        "content_plain",
+        "reset",
+        "content_fragment",
+        "char_format",
+        "init_chunk",
+        "hello",
+        "snapshot_request",
+        "snapshot"
+    };
+
+    const char* const kFailoverNames[] = {
+        "host_lost",
+        "handed_over",
+        "promoted",
+        "reconnected",
+        "fell_back",
+        "gave_up"
+    };
+
+    void add(std::atomic<quint64>& counter, quint64 value = 1)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    quint64 load(const std::atomic<quint64>& counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    QByteArray withLabel(const QByteArray& labels, const char* name, const QByteArray& value)
+    {
+        return labels + ',' + name + "=\"" + value + '"';
+    }
+}
+
+Metrics::Histogram::Histogram()
+{
+    for (auto& count : m_counts)
+    {
+        count.store(0);
+    }
+    m_sumNs.store(0);
+}
+
+// Bucket k holds durations up to 2^k us.
+void Metrics::Histogram::record(qint64 ns)
+{
+    const quint64 us = quint64(std::max<qint64>(ns, 0)) / 1000;
+    const int bucket = us <= 1 ? 0 : std::min(64 - int(qCountLeadingZeroBits(us - 1)), int(kBuckets));
+    add(m_counts[bucket]);
+    add(m_sumNs, quint64(std::max<qint64>(ns, 0)));
+}
+
+void Metrics::Histogram::format(QByteArray &out, const char *name, const QByteArray &labels) const
+{
+    const QByteArray bucket_name = QByteArray(name) + "_bucket";
+    quint64 cumulative = 0;
+    for (int i = 0; i <= kBuckets; ++i)
+    {
+        cumulative += load(m_counts[i]);
+        const QByteArray bound = i < kBuckets ? QByteArray::number(double(quint64(1) << i) / 1e6, 'g', 6) : QByteArray("+Inf");
+        sample(out, bucket_name.constData(), withLabel(labels, "le", bound), double(cumulative));
+    }
+    sample(out, (QByteArray(name) + "_sum").constData(), labels, load(m_sumNs) / 1e9);
+    sample(out, (QByteArray(name) + "_count").constData(), labels, double(cumulative));
+}
+
+Metrics::Metrics()
+{
+    for (int i = 0; i < kMessageTypes; ++i)
+    {
+        m_received[i].store(0);
+        m_sent[i].store(0);
+    }
+    for (auto& count : m_failovers)
+    {
+        count.store(0);
+    }
+    m_receivedBytes.store(0);
+    m_sentBytes.store(0);
+}
+
+void Metrics::received(MessageType type)
+{
+    if (type >= 0 && type < kMessageTypes)
+    {
+        add(m_received[type]);
+    }
+}
+
+void Metrics::sent(MessageType type)
+{
+    if (type >= 0 && type < kMessageTypes)
+    {
+        add(m_sent[type]);
+    }
+}
+
+void Metrics::receivedBytes(qint64 bytes)
+{
+    add(m_receivedBytes, quint64(bytes));
+}
+
+void Metrics::sentBytes(qint64 bytes)
+{
+    add(m_sentBytes, quint64(bytes));
+}
+
+void Metrics::decoded(qint64 ns)
+{
+    m_decode.record(ns);
+}
+
+void Metrics::applied(qint64 ns)
+{
+    m_apply.record(ns);
+}
+
+void Metrics::failover(Failover event)
+{
+    add(m_failovers[event]);
+}
+
+quint64 Metrics::sentBytes() const
+{
+    return load(m_sentBytes);
+}
+
+quint64 Metrics::receivedCount(MessageType type) const
+{
+    return type >= 0 && type < kMessageTypes ? load(m_received[type]) : 0;
+}
+
+quint64 Metrics::failoverCount(Failover event) const
+{
+    return load(m_failovers[event]);
+}
+
+QByteArray Metrics::format(const QByteArray &session_labels) const
+{
+    QByteArray out;
+    header(out, "textedit_messages_received_total", "counter", "Messages decoded, by type.");
+    for (int i = 0; i < kMessageTypes; ++i)
+    {
+        sample(out, "textedit_messages_received_total", withLabel(session_labels, "type", kTypeNames[i]), double(load(m_received[i])));
+    }
+    header(out, "textedit_messages_sent_total", "counter", "Messages this peer sent, by type, once however many peers got them: its own, the ones it relayed as host, and snapshots once per joiner.");
+    for (int i = 0; i < kMessageTypes; ++i)
+    {
+        sample(out, "textedit_messages_sent_total", withLabel(session_labels, "type", kTypeNames[i]), double(load(m_sent[i])));
+    }
+    header(out, "textedit_received_bytes_total", "counter", "Bytes read from sockets and the broadcast channel.");
+    sample(out, "textedit_received_bytes_total", session_labels, double(load(m_receivedBytes)));
+    header(out, "textedit_decode_seconds", "histogram", "Time to decode one message.");
+    m_decode.format(out, "textedit_decode_seconds", session_labels);
+    header(out, "textedit_apply_seconds", "histogram", "Time the GUI thread took to apply one remote op to the document.");
+    m_apply.format(out, "textedit_apply_seconds", session_labels);
+    header(out, "textedit_failover_events_total", "counter", "Steps of host failover, by event.");
+    for (int i = 0; i < kFailoverEvents; ++i)
+    {
+        sample(out, "textedit_failover_events_total", withLabel(session_labels, "event", kFailoverNames[i]), double(load(m_failovers[i])));
+    }
+    return out;
+}
+
+const char *Metrics::typeName(MessageType type)
+{
+    return type >= 0 && type < kMessageTypes ? kTypeNames[type] : "unknown";
+}
+
+QByteArray Metrics::labels(const QString &session)
+{
+    QByteArray escaped = session.toUtf8();
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return "session=\"" + escaped + '"';
+}
+
+void Metrics::header(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out += QByteArray("# HELP ") + name + ' ' + help + '\n';
+    out += QByteArray("# TYPE ") + name + ' ' + type + '\n';
+}
+
+void Metrics::sample(QByteArray &out, const char *name, const QByteArray &labels, double value)
+{
+    out += name;
+    out += '{' + labels + "} ";
+    out += QByteArray::number(value, 'g', 15);
+    out += '\n';
+}
@@ -0,0 +1,100 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <atomic>
+
+#include "messages.h"
+
+// Counters and latency histograms of one session. Recording is a relaxed atomic add, so
+// the network and GUI threads both record without locking and it can stay on; format()
+// renders everything in the Prometheus text exposition format.
+class Metrics
+{
+public:
+    enum Failover
+    {
+        // The host said it is leaving, with kRunServer or kServerDown.
+        kHostLost,
+        kHandedOver,
+        kPromoted,
+        kReconnected,
+        kFellBack,
+        kGaveUp
+    };
+
+    // Durations in power-of-two buckets from 1us to about 1s.
+    class Histogram
+    {
+    public:
+        Histogram();
+
+        Histogram(const Histogram&) = delete;
+        Histogram& operator=(const Histogram&) = delete;
+
+        void record(qint64 ns);
+
+        void format(QByteArray& out, const char* name, const QByteArray& labels) const;
+
+    private:
+        static const int kBuckets = 21;
+
+        // The last one is +Inf.
+        std::atomic<quint64> m_counts[kBuckets + 1];
+        std::atomic<quint64> m_sumNs;
+    };
+
+    Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void received(MessageType type);
+
+    void sent(MessageType type);
+
+    void receivedBytes(qint64 bytes);
+
+    // Bytes written directly to a socket; what goes through an OutboundQueue is in its stats.
+    void sentBytes(qint64 bytes);
+
+    void decoded(qint64 ns);
+
+    void applied(qint64 ns);
+
+    void failover(Failover event);
+
+    quint64 sentBytes() const;
+
+    quint64 receivedCount(MessageType type) const;
+
+    quint64 failoverCount(Failover event) const;
+
+    // The session's counters, each sample labelled with labels.
+    QByteArray format(const QByteArray& labels) const;
+
+    static const char* typeName(MessageType type);
+
+    // session="..." for the samples the owner adds itself.
+    static QByteArray labels(const QString& session);
+
+    static void header(QByteArray& out, const char* name, const char* type, const char* help);
+
+    static void sample(QByteArray& out, const char* name, const QByteArray& labels, double value);
+
+private:
+    static const int kMessageTypes = kSnapshot + 1;
+    static const int kFailoverEvents = kGaveUp + 1;
+
+    std::atomic<quint64> m_received[kMessageTypes];
+    std::atomic<quint64> m_sent[kMessageTypes];
+    std::atomic<quint64> m_receivedBytes;
+    std::atomic<quint64> m_sentBytes;
+    std::atomic<quint64> m_failovers[kFailoverEvents];
+    Histogram m_decode;
+    Histogram m_apply;
+};
+
+#endif // METRICS_H
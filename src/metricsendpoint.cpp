@@ -0,0 +1,162 @@
+#include "metricsendpoint.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QHash>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutexLocker>
+#include <QSharedPointer>
+#include <QThread>
+#include <QTimer>
+
+namespace
+{
+    // Whoever holds the name answers at once; this only bounds a wedged one.
+    const int kProbeTimeout = 100;
+}
+
+MetricsEndpoint* MetricsEndpoint::instance()
+{
+    static MetricsEndpoint* endpoint = new MetricsEndpoint;
+    return endpoint;
+}
+
+MetricsEndpoint::MetricsEndpoint() :
+    m_server(new QLocalServer(this))
+{
+    connect(m_server, &QLocalServer::newConnection, this, &MetricsEndpoint::newConnection);
+    QCoreApplication* application = QCoreApplication::instance();
+    moveToThread(application->thread());
+    connect(application, &QCoreApplication::aboutToQuit, this, &MetricsEndpoint::close);
+    QMetaObject::invokeMethod(this, "listen", Qt::QueuedConnection);
+}
+
+void MetricsEndpoint::add(QObject *source)
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_sources.contains(source))
+    {
+        m_sources.push_back(source);
+    }
+}
+
+void MetricsEndpoint::remove(QObject *source)
+{
+    QMutexLocker lock(&m_mutex);
+    m_sources.removeAll(source);
+}
+
+QString MetricsEndpoint::name()
+{
+    return QString("textedit-metrics.%1").arg(QCoreApplication::applicationPid());
+}
+
+// The family of a sample is the one whose header came last; a family keeps the header of
+// the first text that has it and its place in that text.
+QByteArray MetricsEndpoint::merge(const QList<QByteArray> &texts)
+{
+    QList<QByteArray> families;
+    QHash<QByteArray, int> first_text;
+    QHash<QByteArray, QByteArray> headers;
+    QHash<QByteArray, QByteArray> samples;
+    for (int i = 0; i < texts.size(); ++i)
+    {
+        QByteArray family;
+        for (auto& line : texts[i].split('\n'))
+        {
+            if (line.isEmpty())
+            {
+                continue;
+            }
+            if (line.startsWith("# "))
+            {
+                family = line.split(' ').value(2);
+                if (!first_text.contains(family))
+                {
+                    first_text.insert(family, i);
+                    families.push_back(family);
+                }
+                if (first_text.value(family) == i)
+                {
+                    headers[family] += line + '\n';
+                }
+                continue;
+            }
+            samples[family] += line + '\n';
+        }
+    }
+    QByteArray out;
+    for (auto& family : families)
+    {
+        out += headers.value(family);
+        out += samples.value(family);
+    }
+    return out;
+}
+
+// The name carries this process's pid, so a socket under it was left behind by an earlier
+// process; it is only removed once a probe finds nobody answering on it.
+void MetricsEndpoint::listen()
+{
+    QLocalSocket* probe = new QLocalSocket(this);
+    QSharedPointer<bool> answered(new bool(false));
+    auto finish = [this, probe, answered](bool in_use) {
+        if (*answered)
+        {
+            return;
+        }
+        *answered = true;
+        probe->deleteLater();
+        if (in_use)
+        {
+            qDebug() << "listen" << name() << "is in use, not serving metrics";
+            return;
+        }
+        QLocalServer::removeServer(name());
+        if (!m_server->listen(name()))
+        {
+            qDebug() << "listen" << m_server->errorString();
+        }
+    };
+    connect(probe, &QLocalSocket::connected, this, [finish]() { finish(true); });
+    connect(probe, &QLocalSocket::errorOccurred, this, [finish]() { finish(false); });
+    QTimer::singleShot(kProbeTimeout, probe, [finish]() { finish(false); });
+    probe->connectToServer(name());
+}
+
+void MetricsEndpoint::close()
+{
+    m_server->close();
+}
+
+// One scrape per connection: the text, then the connection closes.
+void MetricsEndpoint::newConnection()
+{
+    while (m_server->hasPendingConnections())
+    {
+        QLocalSocket* socket = m_server->nextPendingConnection();
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        socket->write(scrape());
+        socket->disconnectFromServer();
+    }
+}
+
+// Sources on other threads render on theirs, which this waits for.
+QByteArray MetricsEndpoint::scrape()
+{
+    QList<QObject*> sources;
+    {
+        QMutexLocker lock(&m_mutex);
+        sources = m_sources;
+    }
+    QList<QByteArray> texts;
+    for (auto source : sources)
+    {
+        const Qt::ConnectionType type = source->thread() == QThread::currentThread() ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+        QByteArray text;
+        QMetaObject::invokeMethod(source, "metricsText", type, Q_RETURN_ARG(QByteArray, text));
+        texts.push_back(text);
+    }
+    return merge(texts);
+}
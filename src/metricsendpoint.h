@@ -0,0 +1,52 @@
+#ifndef METRICSENDPOINT_H
+#define METRICSENDPOINT_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+
+class QLocalServer;
+
+// The process's metrics socket, textedit-metrics.<pid>, however many sessions it takes part
+// in. Every session adds itself, and a scrape gets one Prometheus text exposition in which
+// each family lists the samples of all of them, told apart by their labels.
+// A source is a QObject with an invokable QByteArray metricsText(); it renders its text on
+// its own thread, which has to run an event loop until the source removes itself. The
+// endpoint lives on the application's thread.
+class MetricsEndpoint : public QObject
+{
+    Q_OBJECT
+public:
+    static MetricsEndpoint* instance();
+
+    // Both may be called from any thread; adding a source twice keeps one.
+    void add(QObject* source);
+
+    void remove(QObject* source);
+
+    static QString name();
+
+    // One exposition from several: a family's header once, then its samples from each.
+    static QByteArray merge(const QList<QByteArray>& texts);
+
+private slots:
+    void listen();
+
+    void close();
+
+    void newConnection();
+
+private:
+    MetricsEndpoint();
+
+    QByteArray scrape();
+
+private:
+    QLocalServer* m_server;
+    QMutex m_mutex;
+    QList<QObject*> m_sources;
+};
+
+#endif // METRICSENDPOINT_H
@@ -0,0 +1,1299 @@
+#include "networkworker.h"
+
+#include "metricsendpoint.h"
+#include "tracing.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    // A hub or host on the same machine answers at once; this only bounds a wedged one.
+    const int kHubProbeTimeout = 100;
+
+    // After a host crash, peers try to take over this far apart in peer id order.
+    const int kPromotionStagger = 20;
+    const int kMaxPromotionDelay = 500;
+
+    // How often a hub session with nobody to ask for a snapshot looks for a donor again.
+    const int kDonorRetryInterval = 250;
+}
+
+NetworkWorker::NetworkWorker(const QString& name, ISerializer* serializer, IDeserializer* deserializer, Transport* transport) :
+    m_transport(transport),
+    m_name(name.isEmpty() ? "default" : name),
+    m_serializer(serializer),
+    m_deserializer(deserializer),
+    m_donorTimer(this),
+    m_pump(this),
+    m_retryTimer(this)
+{
+    if (!m_transport->parent())
+    {
+        m_transport->setParent(this);
+    }
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, &QTimer::timeout, this, &NetworkWorker::retryFailover);
+    m_donorTimer.setSingleShot(true);
+    m_donorTimer.setInterval(kDonorRetryInterval);
+    connect(&m_donorTimer, &QTimer::timeout, this, &NetworkWorker::retrySnapshot);
+}
+
+NetworkWorker::~NetworkWorker()
+{
+    if (m_metricsServed)
+    {
+        MetricsEndpoint::instance()->remove(this);
+    }
+    if (!m_broadcastKey.isEmpty())
+    {
+        m_transport->closeBroadcast(m_broadcastKey);
+    }
+}
+
+// A running hub hosts every session; without one the first peer to start hosts it. Whether
+// a hub answers arrives as connected() or errorOccurred(), or not at all from a wedged one.
+void NetworkWorker::start()
+{
+    m_socket = m_transport->createConnection(this);
+    connect(m_socket, &Connection::errorOccurred, this, &NetworkWorker::socketError);
+    connect(m_socket, &Connection::readyRead, this, &NetworkWorker::readyRead);
+    connect(m_socket, &Connection::connected, this, &NetworkWorker::connectedToServer);
+    connect(m_socket, &Connection::disconnected, this, &NetworkWorker::hostDisconnected);
+    m_probingHub = true;
+    QTimer::singleShot(kHubProbeTimeout, this, [this]() {
+        if (m_probingHub)
+        {
+            startWithoutHub();
+        }
+    });
+    m_socket->connectToServer(hubName());
+}
+
+// Ops typed while the hub was being tried are sequenced as the log's first ones.
+void NetworkWorker::startWithoutHub()
+{
+    m_probingHub = false;
+    m_socket->abort();
+    if (listen())
+    {
+        becomeHost();
+        return;
+    }
+    qDebug() << m_transport->errorString();
+    m_socket->connectToServer(m_name);
+}
+
+// A hub hosts the session without a document of its own: the first joiner is asked for its
+// document instead of being sent one, and the log keeps that snapshot, refreshed by asking
+// a peer again once the tail grows past the log limits.
+bool NetworkWorker::startHub()
+{
+    if (!listen())
+    {
+        qDebug() << __FUNCTION__ << m_transport->errorString();
+        return false;
+    }
+    startHubSession();
+    return true;
+}
+
+void NetworkWorker::startHubSession()
+{
+    m_hub = true;
+    m_serverMode = true;
+    serveMetrics();
+    m_log.setKeepHistory(true);
+}
+
+void NetworkWorker::addPeer(Connection* socket, QSharedPointer<FrameReader> reader, const QByteArray &hello)
+{
+    attach(socket)->reader = reader;
+    handleMessage(socket, hello, Framing::kNoVersion);
+    drain(socket, *reader);
+}
+
+QString NetworkWorker::name() const
+{
+    return m_name;
+}
+
+int NetworkWorker::peerCount() const
+{
+    return m_peers.size();
+}
+
+QString NetworkWorker::hubName()
+{
+    return Transport::hubName();
+}
+
+void NetworkWorker::stop()
+{
+    m_retryTimer.stop();
+    m_failover = kSteady;
+    if (m_metricsServed)
+    {
+        MetricsEndpoint::instance()->remove(this);
+        m_metricsServed = false;
+    }
+    if (m_serverMode)
+    {
+        if (m_listening)
+        {
+            m_transport->close();
+        }
+        if (!m_peers.isEmpty())
+        {
+            passServerRole();
+        }
+    } else if (m_socket)
+    {
+        disconnect(m_socket, &Connection::disconnected, this, &NetworkWorker::hostDisconnected);
+        m_socket->flush();
+        m_socket->abort();
+    }
+}
+
+Metrics &NetworkWorker::metrics()
+{
+    return m_metrics;
+}
+
+bool NetworkWorker::takeInbound(InboundOp &op)
+{
+    return m_inbound.pop(op);
+}
+
+void NetworkWorker::rearm()
+{
+    m_notified.store(false);
+}
+
+void NetworkWorker::post(const InboundOp &op)
+{
+    if (m_hub)
+    {
+        return;
+    }
+    m_inbound.push(op);
+    if (!m_notified.exchange(true))
+    {
+        emit opsAvailable();
+    }
+}
+
+void NetworkWorker::setCompressThreshold(int bytes)
+{
+    m_compressThreshold = bytes;
+}
+
+void NetworkWorker::newConnection()
+{
+    while (m_transport->hasPendingConnections())
+    {
+        attach(m_transport->nextPendingConnection());
+    }
+}
+
+Peer* NetworkWorker::attach(Connection* socket)
+{
+    socket->setParent(this);
+    Peer* peer = m_peers.add(socket);
+    peer->reader.reset(new FrameReader);
+    connect(socket, &Connection::readyRead, this, &NetworkWorker::readyRead);
+    connect(socket, &Connection::errorOccurred, this, &NetworkWorker::socketError);
+    connect(socket, &Connection::disconnected, this, &NetworkWorker::disconnectFromServer);
+    peer->queue = new OutboundQueue(socket->device(), socket);
+    peer->queue->setPump(&m_pump);
+    connect(peer->queue, &OutboundQueue::catchUpNeeded, this, &NetworkWorker::catchUpPeer);
+    connect(peer->queue, &OutboundQueue::overloaded, this, &NetworkWorker::dropPeer);
+    return peer;
+}
+
+void NetworkWorker::readyRead()
+{
+    Connection* editing_socket = (Connection*) sender();
+    QSharedPointer<FrameReader> reader = readerFor(editing_socket);
+    if (reader.isNull())
+    {
+        return;
+    }
+    TraceSpan span("readyRead");
+    const QByteArray data = editing_socket->device()->readAll();
+    m_metrics.receivedBytes(data.size());
+    if (Tracing::enabled())
+    {
+        span.setDetail(QByteArray::number(data.size()) + " bytes");
+    }
+    reader->append(data);
+    drain(editing_socket, *reader);
+    if (editing_socket == m_socket && m_broadcast)
+    {
+        readBroadcast();
+    }
+}
+
+void NetworkWorker::drain(Connection* socket, FrameReader &reader)
+{
+    QByteArray payload;
+    quint64 version = Framing::kNoVersion;
+    while (reader.next(payload, &version))
+    {
+        handleMessage(socket, payload, version);
+    }
+    if (reader.corrupt())
+    {
+        // As with a rejected peer, the abort waits until the caller is done with the socket.
+        qDebug() << __FUNCTION__ << "unframeable stream, dropping the connection";
+        Peer* peer = m_peers.find(socket);
+        if (peer)
+        {
+            peer->reader.clear();
+            ++m_droppedPeers;
+        } else if (socket == m_socket)
+        {
+            m_hostReader.reset();
+        }
+        QMetaObject::invokeMethod(socket, [socket]() { socket->abort(); }, Qt::QueuedConnection);
+    }
+}
+
+// Null for a peer that has already left.
+QSharedPointer<FrameReader> NetworkWorker::readerFor(Connection* socket)
+{
+    if (socket != m_socket)
+    {
+        Peer* peer = m_peers.find(socket);
+        return peer ? peer->reader : QSharedPointer<FrameReader>();
+    }
+    if (m_hostReader.isNull())
+    {
+        m_hostReader.reset(new FrameReader);
+    }
+    return m_hostReader;
+}
+
+void NetworkWorker::socketError()
+{
+    Connection* socket = (Connection*) sender();
+    if (socket == m_socket && m_probingHub)
+    {
+        // No hub. The socket is reused, so not from inside its own signal.
+        m_probingHub = false;
+        QMetaObject::invokeMethod(this, [this]() { startWithoutHub(); }, Qt::QueuedConnection);
+        return;
+    }
+    if (socket == m_socket && m_failover == kReconnecting)
+    {
+        scheduleRetry();
+        return;
+    }
+    qDebug() << __FUNCTION__ << socket->errorString();
+}
+
+void NetworkWorker::disconnectFromServer()
+{
+    Connection* sender_socket = (Connection*) sender();
+    Peer* peer = m_peers.find(sender_socket);
+    if (peer)
+    {
+        retireQueue(peer);
+        if (peer->awaiting_snapshot)
+        {
+            m_awaitingSnapshot.removeOne(sender_socket);
+        }
+        if (peer->broadcast)
+        {
+            --m_broadcastPeers;
+        }
+        m_peers.remove(sender_socket);
+        sender_socket->deleteLater();
+        if (m_snapshotRequested && sender_socket == m_snapshotDonor)
+        {
+            m_snapshotRequested = false;
+            retrySnapshot();
+        }
+        if (m_hub && m_peers.isEmpty())
+        {
+            emit deserted();
+        }
+    }
+}
+
+void NetworkWorker::handleMessage(Connection* editing_socket, const QByteArray &payload, quint64 version)
+{
+    if (version != Framing::kNoVersion && payload.isEmpty())
+    {
+        // The host sequenced our oldest unacknowledged op as version. A broadcast reader
+        // counts it as seen when it comes by on the channel, in order with everyone else's.
+        if (!m_broadcast)
+        {
+            ackedAt(version);
+        }
+        if (!m_unacked.isEmpty())
+        {
+            const QByteArray frame = m_unacked.takeFirst();
+            // Sent before the last kInit but sequenced after the body it cut: the reset lost
+            // it, so it is applied again now, in order with everyone else's ops.
+            if (m_unappliedOps > 0)
+            {
+                --m_unappliedOps;
+                repost(frame);
+            }
+        }
+        return;
+    }
+
+    InboundOp op;
+    if (!decode(payload, op.message))
+    {
+        return;
+    }
+    const Message& message = op.message;
+    if (version != Framing::kNoVersion)
+    {
+        if (message.type != kInit && m_ackedAhead.remove(version))
+        {
+            // Our own op, sent back in the tail of a resume.
+            m_lastSeen = std::max(m_lastSeen, version);
+            absorbAckedAhead();
+            return;
+        }
+        // Snapshot extras are older than the kInit they follow, which sets the version outright.
+        const bool reset = message.type == kInit || m_lastSeen == Framing::kNoVersion;
+        m_lastSeen = reset ? version : std::max(m_lastSeen, version);
+        if (reset)
+        {
+            m_ackedAhead.clear();
+        }
+        absorbAckedAhead();
+    }
+    switch (message.type)
+    {
+        case MessageType::kInit:
+        {
+            // A fresh document. Acks come in order with the body, so what this peer sent
+            // and is still unacknowledged is not in it; it is applied again once acked.
+            m_unappliedOps = m_unacked.size();
+            post(op);
+            return;
+        }
+        case MessageType::kSnapshotRequest:
+        {
+            // readyRead drains the socket before the channel, where a reader finds the ops
+            // the hub sequenced before asking; the snapshot has to reflect them.
+            if (m_broadcast)
+            {
+                readBroadcastUntil(message.snapshot.version);
+            }
+            InboundOp request;
+            request.kind = InboundOp::kSnapshotRequest;
+            post(request);
+            return;
+        }
+        case MessageType::kSnapshot:
+        {
+            if (m_serverMode && m_snapshotRequested && editing_socket == m_snapshotDonor)
+            {
+                installSnapshot(message.snapshot.payloads);
+            }
+            return;
+        }
+        case MessageType::kInitChunk:
+        {
+            post(op);
+            return;
+        }
+        case MessageType::kHello:
+        {
+            handleHelloMessage(editing_socket, message.hello);
+            return;
+        }
+        case MessageType::kRunServer:
+        {
+            handleRunServerMessage(message.run_server);
+            return;
+        }
+        case MessageType::kServerDown:
+        {
+            handleServerDownMessage();
+            return;
+        }
+        default:
+            break;
+    }
+
+    // Relay before the GUI thread gets to apply the op.
+    post(op);
+    if (m_serverMode)
+    {
+        TraceSpan span("relay", message.trace);
+        m_metrics.sent(message.type);
+        const quint64 sequenced = m_log.version() + 1;
+        QByteArray frame = Framing::pack(payload, sequenced);
+        m_log.append(frame);
+        if (m_snapshotRequested && editing_socket != m_snapshotDonor)
+        {
+            m_sinceRequest.push_back(frame);
+        }
+        Peer* editing_peer = m_peers.find(editing_socket);
+        broadcast(frame, editing_peer);
+        if (editing_peer)
+        {
+            editing_peer->queue->enqueue(Framing::pack(QByteArray(), sequenced));
+        }
+        if (m_log.needsSnapshot() && !m_snapshotRequested)
+        {
+            requestSnapshot();
+        }
+    }
+}
+
+// While the host drops a peer's frames to let it catch up, the peer still gets the acks of
+// its own ops. Those past a gap are kept apart until it fills, so m_lastSeen never skips an
+// op of someone else; a resume asks for the gap and the peer's own ops in it are skipped.
+void NetworkWorker::ackedAt(quint64 version)
+{
+    if (m_lastSeen != Framing::kNoVersion && version > m_lastSeen + 1)
+    {
+        m_ackedAhead.insert(version);
+        return;
+    }
+    m_lastSeen = m_lastSeen == Framing::kNoVersion ? version : std::max(m_lastSeen, version);
+    absorbAckedAhead();
+}
+
+void NetworkWorker::absorbAckedAhead()
+{
+    auto it = m_ackedAhead.begin();
+    while (it != m_ackedAhead.end())
+    {
+        if (*it <= m_lastSeen)
+        {
+            it = m_ackedAhead.erase(it);
+        } else
+        {
+            ++it;
+        }
+    }
+    while (m_ackedAhead.remove(m_lastSeen + 1))
+    {
+        ++m_lastSeen;
+    }
+}
+
+// Hands an op this peer sent back to the GUI thread, as if it came from someone else.
+void NetworkWorker::repost(const QByteArray &frame)
+{
+    FrameReader reader;
+    reader.append(frame);
+    QByteArray payload;
+    InboundOp op;
+    if (reader.next(payload) && decode(payload, op.message))
+    {
+        post(op);
+    }
+}
+
+void NetworkWorker::handleHelloMessage(Connection* socket, const HelloMessage &message)
+{
+    if (!m_serverMode)
+    {
+        m_hostCompresses = m_compressThreshold > 0 && (message.capabilities & kCompression);
+        m_peerId = message.peer;
+        serveMetrics();
+        if ((message.capabilities & kBroadcast) && !m_broadcast)
+        {
+            joinBroadcast(message.broadcast, message.position);
+        }
+        return;
+    }
+    Peer* peer = m_peers.find(socket);
+    if (!peer)
+    {
+        return;
+    }
+    if (!m_hub && message.session != m_name)
+    {
+        // Over TCP a peer of another session can end up here; nothing it sent may be
+        // relayed, so its reader goes before the abort, which waits for the drain to end.
+        qDebug() << __FUNCTION__ << "rejecting a peer of session" << message.session;
+        peer->reader->clear();
+        peer->reader.clear();
+        QMetaObject::invokeMethod(socket, [socket]() { socket->abort(); }, Qt::QueuedConnection);
+        return;
+    }
+    if (m_compressThreshold > 0 && (message.capabilities & kCompression))
+    {
+        peer->compressing = true;
+    }
+    // A peer reads the channel from where it stands now; the body below brings it up to there.
+    // The channel is opened for the first peer on the machine that asks for it.
+    if ((message.capabilities & kBroadcast) && m_broadcastKey.isEmpty())
+    {
+        openBroadcast();
+    }
+    const bool reads_broadcast = !m_broadcastKey.isEmpty() && (message.capabilities & kBroadcast);
+    m_broadcastPeers += int(reads_broadcast) - int(peer->broadcast);
+    peer->broadcast = reads_broadcast;
+    OutboundQueue* queue = peer->queue;
+    Message hello;
+    hello.type = kHello;
+    hello.hello.capabilities = (m_compressThreshold > 0 ? kCompression : 0) | (reads_broadcast ? kBroadcast : 0);
+    hello.hello.peer = peer->id;
+    if (reads_broadcast)
+    {
+        hello.hello.broadcast = m_broadcastKey;
+        hello.hello.position = m_transport->broadcastPosition(m_broadcastKey);
+    }
+    queue->enqueue(Framing::pack(encode(hello)));
+    peer->joined = true;
+
+    QList<QByteArray> missing;
+    if (message.resume && m_log.tailSince(message.version, missing))
+    {
+        for (auto& frame : missing)
+        {
+            queue->enqueue(frameFor(peer, frame));
+        }
+        return;
+    }
+    sendBody(peer);
+}
+
+void NetworkWorker::sendHello(bool broadcast)
+{
+    Message hello;
+    hello.type = kHello;
+    hello.hello.capabilities = (m_compressThreshold > 0 ? kCompression : 0) | (broadcast && m_transport->canBroadcast() ? kBroadcast : 0);
+    hello.hello.resume = m_lastSeen != Framing::kNoVersion;
+    hello.hello.version = m_lastSeen;
+    hello.hello.session = m_name;
+    write(m_socket, Framing::pack(encode(hello)));
+}
+
+// The old host flushed everything to us before this, so the tail only matters if we
+// lagged anyway; it also lets us bring the other peers up to date when they reconnect.
+void NetworkWorker::handleRunServerMessage(const RunServerMessage &message)
+{
+    m_metrics.failover(Metrics::kHostLost);
+    closeBroadcastReader();
+    for (auto& frame : message.tail)
+    {
+        const quint64 version = Framing::version(frame);
+        if (m_ackedAhead.remove(version))
+        {
+            m_lastSeen = version;
+            continue;
+        }
+        if (m_lastSeen != Framing::kNoVersion && version <= m_lastSeen)
+        {
+            continue;
+        }
+        FrameReader reader;
+        reader.append(frame);
+        QByteArray payload;
+        InboundOp op;
+        if (reader.next(payload) && decode(payload, op.message))
+        {
+            post(op);
+        }
+        m_lastSeen = version;
+    }
+    m_log.resume(message.version, message.tail);
+    m_resumed = true;
+    beginFailover(kPromoting);
+}
+
+void NetworkWorker::handleServerDownMessage()
+{
+    m_metrics.failover(Metrics::kHostLost);
+    beginFailover(kReconnecting);
+    closeBroadcastReader();
+    m_socket->abort();
+    readerFor(m_socket)->clear();
+    m_hostCompresses = false;
+}
+
+// The host went away without handing the session to anyone, crashed or killed. Every peer
+// holding the document tries to host it, the oldest first, and the others find the winner
+// by probing and reconnect; a peer still waiting for its first body can only reconnect.
+void NetworkWorker::hostDisconnected()
+{
+    if (m_serverMode || m_failover != kSteady)
+    {
+        return;
+    }
+    qDebug() << __FUNCTION__ << "lost the host";
+    m_metrics.failover(Metrics::kHostLost);
+    closeBroadcastReader();
+    readerFor(m_socket)->clear();
+    m_hostCompresses = false;
+    if (m_lastSeen == Framing::kNoVersion)
+    {
+        beginFailover(kReconnecting);
+    } else
+    {
+        beginFailover(kPromoting, std::min(int(m_peerId) * kPromotionStagger, kMaxPromotionDelay));
+    }
+}
+
+// The transport may be a hub's, shared with its other sessions; listen() is never called on
+// that one, so its new connections stay the hub's.
+bool NetworkWorker::listen()
+{
+    if (!m_transport->listen(m_name))
+    {
+        return false;
+    }
+    m_listening = true;
+    connect(m_transport, &Transport::newConnection, this, &NetworkWorker::newConnection, Qt::UniqueConnection);
+    return true;
+}
+
+void NetworkWorker::openBroadcast()
+{
+    if (m_transport->canBroadcast())
+    {
+        m_broadcastKey = m_transport->openBroadcast(m_name);
+    }
+}
+
+void NetworkWorker::joinBroadcast(const QString &key, quint64 position)
+{
+    m_broadcast.reset(m_transport->attachBroadcast(key, position, nullptr));
+    if (!m_broadcast)
+    {
+        leaveBroadcast();
+        return;
+    }
+    connect(m_broadcast.data(), &BroadcastReader::readyRead, this, &NetworkWorker::readBroadcast);
+    readBroadcast();
+}
+
+// Back to getting everything over the socket, from the last version this peer applied.
+void NetworkWorker::leaveBroadcast()
+{
+    qDebug() << __FUNCTION__ << "at version" << m_lastSeen;
+    m_broadcast.reset();
+    m_held.clear();
+    sendHello(false);
+    m_socket->flush();
+}
+
+// Takes in what the old host published before it went; its socket said so after publishing.
+void NetworkWorker::closeBroadcastReader()
+{
+    readBroadcast();
+    m_broadcast.reset();
+    m_held.clear();
+}
+
+// Applies channel frames strictly in version order. One that runs ahead of the socket,
+// which still owes this peer the body or the tail before it, is held until that arrives.
+void NetworkWorker::readBroadcast()
+{
+    readBroadcastUntil(std::numeric_limits<quint64>::max());
+}
+
+// Frames after until stay held for the next read.
+void NetworkWorker::readBroadcastUntil(quint64 until)
+{
+    while (m_broadcast)
+    {
+        if (m_held.isEmpty())
+        {
+            const BroadcastReader::Result result = m_broadcast->next(m_held, m_heldOrigin);
+            if (result == BroadcastReader::kEmpty)
+            {
+                return;
+            }
+            if (result == BroadcastReader::kOverrun)
+            {
+                leaveBroadcast();
+                return;
+            }
+            m_metrics.receivedBytes(m_held.size());
+        }
+        const quint64 version = Framing::version(m_held);
+        if (m_lastSeen == Framing::kNoVersion || version > m_lastSeen + 1 || version > until)
+        {
+            return;
+        }
+        QByteArray frame;
+        frame.swap(m_held);
+        if (version <= m_lastSeen)
+        {
+            continue;
+        }
+        if (m_heldOrigin == m_peerId)
+        {
+            m_lastSeen = version;
+            continue;
+        }
+        FrameReader reader;
+        reader.append(frame);
+        QByteArray payload;
+        if (reader.next(payload))
+        {
+            handleMessage(m_socket, payload, version);
+        }
+    }
+}
+
+void NetworkWorker::beginFailover(FailoverState state, int delay)
+{
+    m_failover = state;
+    m_fallenBack = false;
+    m_retryDelay = 0;
+    m_failoverClock.start();
+    m_retryTimer.start(delay);
+}
+
+void NetworkWorker::retryFailover()
+{
+    if (m_failover == kPromoting)
+    {
+        if (listen())
+        {
+            qDebug() << __FUNCTION__ << "hosting after" << m_failoverClock.elapsed() << "ms";
+            m_metrics.failover(Metrics::kPromoted);
+            m_socket->abort();
+            m_failover = kSteady;
+            becomeHost();
+            return;
+        }
+        if (m_transport->addressInUse())
+        {
+            probeSession();
+            return;
+        }
+        scheduleRetry();
+    } else if (m_failover == kReconnecting)
+    {
+        // The outcome arrives as connected() or errorOccurred().
+        m_socket->abort();
+        m_socket->connectToServer(m_name);
+    }
+}
+
+// listen() found the name taken. Either the old host's socket file was left behind or another
+// peer got the name first; only a probe tells them apart. The answer arrives as connected()
+// or errorOccurred(), and no answer in time counts as a stale name.
+void NetworkWorker::probeSession()
+{
+    Connection* probe = m_transport->createConnection(this);
+    QSharedPointer<bool> answered(new bool(false));
+    auto finish = [this, probe, answered](bool hosted) {
+        if (*answered)
+        {
+            return;
+        }
+        *answered = true;
+        probe->deleteLater();
+        if (m_failover != kPromoting)
+        {
+            return;
+        }
+        if (hosted)
+        {
+            qDebug() << "probeSession" << "another peer hosts, reconnecting";
+            m_failover = kReconnecting;
+            m_retryDelay = 0;
+            m_retryTimer.start(0);
+            return;
+        }
+        m_transport->removeStale(m_name);
+        scheduleRetry();
+    };
+    connect(probe, &Connection::connected, this, [finish]() { finish(true); });
+    connect(probe, &Connection::errorOccurred, this, [finish]() { finish(false); });
+    QTimer::singleShot(kHubProbeTimeout, probe, [finish]() { finish(false); });
+    probe->connectToServer(m_name);
+}
+
+void NetworkWorker::scheduleRetry()
+{
+    if (m_retryTimer.isActive())
+    {
+        return;
+    }
+    if (m_failoverClock.elapsed() >= m_failoverTimeout)
+    {
+        if (m_fallenBack)
+        {
+            qDebug() << __FUNCTION__ << "failover timed out, working offline";
+            m_metrics.failover(Metrics::kGaveUp);
+            m_failover = kSteady;
+            return;
+        }
+        m_fallenBack = true;
+        m_metrics.failover(Metrics::kFellBack);
+        m_failover = m_failover == kPromoting ? kReconnecting : kPromoting;
+        m_retryDelay = 0;
+        m_failoverClock.restart();
+    }
+    m_retryTimer.start(m_retryDelay);
+    m_retryDelay = qBound(2, m_retryDelay * 2, 250);
+}
+
+void NetworkWorker::connectedToServer()
+{
+    m_probingHub = false;
+    if (m_failover == kReconnecting)
+    {
+        qDebug() << __FUNCTION__ << "reconnected after" << m_failoverClock.elapsed() << "ms";
+        m_metrics.failover(Metrics::kReconnected);
+        m_failover = kSteady;
+        m_retryTimer.stop();
+    }
+    sendHello();
+    for (auto& frame : m_unacked)
+    {
+        write(m_socket, frame);
+    }
+    m_socket->flush();
+}
+
+// Continues the version numbering of the previous host (from what this peer has seen,
+// if it took over without a handover) and sequences the ops the old host never acknowledged.
+void NetworkWorker::becomeHost()
+{
+    if (!m_resumed)
+    {
+        m_log.resume(m_lastSeen == Framing::kNoVersion ? 0 : m_lastSeen, QList<QByteArray>());
+    }
+    m_serverMode = true;
+    serveMetrics();
+    QList<QByteArray> unacked;
+    unacked.swap(m_unacked);
+    for (auto& frame : unacked)
+    {
+        FrameReader reader;
+        reader.append(frame);
+        QByteArray payload;
+        if (reader.next(payload))
+        {
+            m_log.append(Framing::pack(payload, m_log.version() + 1));
+        }
+        if (m_unappliedOps > 0)
+        {
+            --m_unappliedOps;
+            repost(frame);
+        }
+    }
+    m_ackedAhead.clear();
+    m_resumed = false;
+    emit hosting();
+}
+
+void NetworkWorker::send(const Message &message)
+{
+    const QByteArray payload = encode(message);
+    if (m_serverMode)
+    {
+        TraceSpan span("relay", message.trace);
+        QByteArray frame = Framing::pack(payload, m_log.version() + 1);
+        m_log.append(frame);
+        broadcast(frame);
+        return;
+    }
+    // Kept until the host acknowledges it, to be sent again if the host goes away first.
+    QByteArray frame = Framing::pack(payload);
+    m_unacked.push_back(frame);
+    if (m_failover == kSteady && m_socket && m_socket->isConnected())
+    {
+        TraceSpan span("write", message.trace);
+        write(m_socket, m_hostCompresses ? Framing::compress(frame, m_compressThreshold) : frame);
+        m_socket->flush();
+    }
+}
+
+// Snapshot chunks go through the peer's queue like everything else, so a large document
+// reaches the joiner only as fast as it reads. Without a fresh snapshot the joiner waits
+// for one to be taken.
+void NetworkWorker::sendBody(Peer* peer)
+{
+    QList<QByteArray> tail;
+    if (!m_log.hasFreshSnapshot() || !m_log.tailSince(m_log.snapshotVersion(), tail))
+    {
+        if (!peer->awaiting_snapshot)
+        {
+            peer->awaiting_snapshot = true;
+            m_awaitingSnapshot.push_back(peer->socket);
+        }
+        if (!m_snapshotRequested)
+        {
+            requestSnapshot();
+        }
+        return;
+    }
+    OutboundQueue* queue = peer->queue;
+    const QList<QByteArray>& snapshot = m_log.snapshot();
+    queue->enqueue(frameFor(peer, snapshot.first()));
+    for (auto& frame : m_log.snapshotExtras())
+    {
+        queue->enqueue(frameFor(peer, frame));
+    }
+    for (auto& frame : tail)
+    {
+        queue->enqueue(frameFor(peer, frame));
+    }
+    for (int i = 1; i < snapshot.size(); ++i)
+    {
+        queue->enqueue(frameFor(peer, snapshot[i]));
+        m_metrics.sent(kInitChunk);
+    }
+    m_metrics.sent(kInit);
+}
+
+// The document lives on the GUI thread of this process or, for a hub, with a peer. Either
+// way the answer reflects every op sequenced before the request plus the source's own
+// later ops; the remote ops sequenced meanwhile are kept as the snapshot's extras.
+void NetworkWorker::requestSnapshot()
+{
+    m_sinceRequest.clear();
+    m_snapshotDonor = nullptr;
+    if (m_hub)
+    {
+        // Before the session is seeded a joiner's own document is all there is, so it
+        // donates that and is not sent a body.
+        Peer* donor = nullptr;
+        for (auto peer : m_peers.peers())
+        {
+            if (peer->joined && (!peer->awaiting_snapshot || !m_seeded) && !peer->queue->catchingUp())
+            {
+                donor = peer;
+                break;
+            }
+        }
+        if (!donor)
+        {
+            m_donorTimer.start();
+            return;
+        }
+        if (donor->awaiting_snapshot)
+        {
+            donor->awaiting_snapshot = false;
+            m_awaitingSnapshot.removeOne(donor->socket);
+        }
+        m_snapshotDonor = donor->socket;
+        Message request;
+        request.type = kSnapshotRequest;
+        request.snapshot.version = m_log.version();
+        donor->queue->enqueue(Framing::pack(encode(request)));
+    } else
+    {
+        InboundOp request;
+        request.kind = InboundOp::kSnapshotRequest;
+        post(request);
+    }
+    m_snapshotRequested = true;
+}
+
+void NetworkWorker::setSnapshot(const QList<Message> &messages)
+{
+    QList<QByteArray> payloads;
+    for (auto& message : messages)
+    {
+        payloads.push_back(m_serializer->Process(message));
+    }
+    if (!m_serverMode)
+    {
+        Message answer;
+        answer.type = kSnapshot;
+        answer.snapshot.payloads = payloads;
+        write(m_socket, Framing::pack(encode(answer)));
+        return;
+    }
+    installSnapshot(payloads);
+}
+
+// The kInit frame carries the version the snapshot is at, the chunks none.
+void NetworkWorker::installSnapshot(const QList<QByteArray> &payloads)
+{
+    QList<QByteArray> frames;
+    for (int i = 0; i < payloads.size(); ++i)
+    {
+        frames.push_back(i == 0 ? Framing::pack(payloads[i], m_log.version()) : Framing::pack(payloads[i]));
+    }
+    m_log.setSnapshot(frames, m_sinceRequest);
+    m_sinceRequest.clear();
+    m_snapshotRequested = false;
+    m_snapshotDonor = nullptr;
+    m_seeded = true;
+
+    QList<Connection*> waiting;
+    waiting.swap(m_awaitingSnapshot);
+    for (auto& socket : waiting)
+    {
+        Peer* peer = m_peers.find(socket);
+        if (peer)
+        {
+            peer->awaiting_snapshot = false;
+            sendBody(peer);
+        }
+    }
+}
+
+// A broadcast reader's socket only carries acks, so one that backs up is not reading at all;
+// a body would also reset it behind the ops it has already taken from the channel.
+void NetworkWorker::catchUpPeer()
+{
+    OutboundQueue* queue = (OutboundQueue*) sender();
+    Peer* peer = m_peers.find((Connection*) queue->parent());
+    if (!peer)
+    {
+        return;
+    }
+    if (peer->broadcast)
+    {
+        ++m_droppedPeers;
+        peer->socket->abort();
+        return;
+    }
+    // A snapshot request may have been among the frames it lost; it is asked again.
+    const bool lost_request = m_snapshotRequested && peer->socket == m_snapshotDonor;
+    if (lost_request)
+    {
+        m_snapshotRequested = false;
+        m_snapshotDonor = nullptr;
+    }
+    sendBody(peer);
+    if (lost_request && !m_snapshotRequested)
+    {
+        retrySnapshot();
+    }
+}
+
+void NetworkWorker::retrySnapshot()
+{
+    if (!m_snapshotRequested && (!m_awaitingSnapshot.isEmpty() || m_log.needsSnapshot()))
+    {
+        requestSnapshot();
+    }
+}
+
+// Overloads are noticed mid fan-out; the abort waits so the peer leaves the registry after it.
+void NetworkWorker::dropPeer()
+{
+    OutboundQueue* queue = (OutboundQueue*) sender();
+    Connection* socket = (Connection*) queue->parent();
+    ++m_droppedPeers;
+    QMetaObject::invokeMethod(socket, [socket]() { socket->abort(); }, Qt::QueuedConnection);
+}
+
+// Every recipient's queue holds the same frame, or the same compressed copy of it, made
+// at most once; nothing is encoded or copied per peer until the socket buffers it.
+void NetworkWorker::broadcast(const QByteArray &frame, const Peer* except)
+{
+    // Channel readers get everything published, their own ops included, so they can keep
+    // versions in order; they skip it on the socket unless publishing failed.
+    const bool published = m_broadcastPeers > 0 && m_transport->publish(m_broadcastKey, frame, except ? except->id : 0);
+    QByteArray compressed;
+    for (auto peer : m_peers.peers())
+    {
+        if (peer == except || !peer->joined || peer->awaiting_snapshot || (published && peer->broadcast))
+        {
+            continue;
+        }
+        if (peer->compressing)
+        {
+            if (compressed.isNull())
+            {
+                compressed = Framing::compress(frame, m_compressThreshold);
+            }
+            peer->queue->enqueue(compressed);
+        } else
+        {
+            peer->queue->enqueue(frame);
+        }
+    }
+}
+
+QByteArray NetworkWorker::frameFor(const Peer* peer, const QByteArray &frame)
+{
+    return peer->compressing ? Framing::compress(frame, m_compressThreshold) : frame;
+}
+
+OutboundQueue::Stats NetworkWorker::outboundStats() const
+{
+    OutboundQueue::Stats total = m_retiredStats;
+    for (auto peer : m_peers.peers())
+    {
+        const OutboundQueue::Stats stats = peer->queue->stats();
+        total.queued_bytes += stats.queued_bytes;
+        total.peak_queued_bytes = std::max(total.peak_queued_bytes, stats.peak_queued_bytes);
+        total.sent_frames += stats.sent_frames;
+        total.sent_bytes += stats.sent_bytes;
+        total.dropped_frames += stats.dropped_frames;
+        total.catch_ups += stats.catch_ups;
+    }
+    return total;
+}
+
+quint64 NetworkWorker::droppedPeers() const
+{
+    return m_droppedPeers;
+}
+
+void NetworkWorker::retireQueue(const Peer* peer)
+{
+    const OutboundQueue::Stats stats = peer->queue->stats();
+    m_retiredStats.peak_queued_bytes = std::max(m_retiredStats.peak_queued_bytes, stats.peak_queued_bytes);
+    m_retiredStats.sent_frames += stats.sent_frames;
+    m_retiredStats.sent_bytes += stats.sent_bytes;
+    m_retiredStats.dropped_frames += stats.dropped_frames;
+    m_retiredStats.catch_ups += stats.catch_ups;
+}
+
+// Hands the role to the peer that has received the most, along with the ops the
+// furthest behind of the others may still be missing.
+void NetworkWorker::passServerRole()
+{
+    Connection* successor = nullptr;
+    quint64 successor_version = 0;
+    quint64 oldest_version = m_log.version();
+    for (auto peer : m_peers.peers())
+    {
+        peer->queue->flush();
+        peer->socket->flush();
+        if (!peer->joined || peer->awaiting_snapshot || peer->queue->catchingUp())
+        {
+            continue;
+        }
+        // Whatever was published is in the channel, which outlives this host for its readers.
+        const quint64 delivered = peer->broadcast ? m_log.version() : peer->queue->deliveredVersion();
+        oldest_version = std::min(oldest_version, delivered);
+        if (!successor || delivered > successor_version)
+        {
+            successor = peer->socket;
+            successor_version = delivered;
+        }
+    }
+    // Joiners have no document yet and a peer catching up a stale one. Without anyone else
+    // there is no handover; the peers see the host go as after a crash.
+    if (successor)
+    {
+        Message message;
+        message.type = kRunServer;
+        message.run_server.version = m_log.version();
+        if (!m_log.tailSince(oldest_version, message.run_server.tail))
+        {
+            message.run_server.tail = m_log.tail();
+        }
+
+        write(successor, Framing::pack(encode(message)));
+        successor->flush();
+
+        message = Message();
+        message.type = kServerDown;
+
+        QByteArray down_message = Framing::pack(encode(message));
+
+        for (auto peer : m_peers.peers())
+        {
+            if (peer->socket != successor)
+            {
+                write(peer->socket, down_message);
+                peer->socket->flush();
+            }
+        }
+        m_metrics.failover(Metrics::kHandedOver);
+    } else
+    {
+        qDebug() << __FUNCTION__ << "no peer can take over the session";
+    }
+    const QList<Connection*> sockets = m_peers.takeSockets();
+    m_awaitingSnapshot.clear();
+    m_broadcastPeers = 0;
+    m_transport->closeBroadcast(m_broadcastKey);
+    m_broadcastKey.clear();
+    for (auto& socket : sockets)
+    {
+        delete socket;
+    }
+}
+
+QByteArray NetworkWorker::metricsText() const
+{
+    // Clients of one session in one process are told apart by the id their host gave them.
+    QByteArray labels = Metrics::labels(m_name);
+    if (!m_serverMode)
+    {
+        labels += ",peer=\"" + QByteArray::number(m_peerId) + '"';
+    }
+    const OutboundQueue::Stats queues = outboundStats();
+    QByteArray out = m_metrics.format(labels);
+    Metrics::header(out, "textedit_sent_bytes_total", "counter", "Bytes handed to sockets.");
+    Metrics::sample(out, "textedit_sent_bytes_total", labels, double(m_metrics.sentBytes() + queues.sent_bytes));
+    Metrics::header(out, "textedit_relayed_frames_total", "counter", "Frames handed to peers from their send queues.");
+    Metrics::sample(out, "textedit_relayed_frames_total", labels, double(queues.sent_frames));
+    Metrics::header(out, "textedit_dropped_frames_total", "counter", "Frames dropped from overflowing send queues.");
+    Metrics::sample(out, "textedit_dropped_frames_total", labels, double(queues.dropped_frames));
+    Metrics::header(out, "textedit_catch_ups_total", "counter", "Snapshots resent to peers whose send queue overflowed.");
+    Metrics::sample(out, "textedit_catch_ups_total", labels, double(queues.catch_ups));
+    Metrics::header(out, "textedit_dropped_peers_total", "counter", "Peers disconnected for not keeping up.");
+    Metrics::sample(out, "textedit_dropped_peers_total", labels, double(m_droppedPeers));
+    Metrics::header(out, "textedit_hosting", "gauge", "Whether this peer hosts the session.");
+    Metrics::sample(out, "textedit_hosting", labels, m_serverMode ? 1 : 0);
+    if (!m_serverMode)
+    {
+        return out;
+    }
+    Metrics::header(out, "textedit_session_version", "gauge", "Ops sequenced in the session.");
+    Metrics::sample(out, "textedit_session_version", labels, double(m_log.version()));
+    Metrics::header(out, "textedit_peers", "gauge", "Peers connected to this host.");
+    Metrics::sample(out, "textedit_peers", labels, m_peers.size());
+    Metrics::header(out, "textedit_peer_queued_bytes", "gauge", "Bytes waiting in a peer's send queue and socket buffer.");
+    for (auto peer : m_peers.peers())
+    {
+        Metrics::sample(out, "textedit_peer_queued_bytes", labels + ",peer=\"" + QByteArray::number(peer->id) + '"', double(peer->queue->stats().queued_bytes));
+    }
+    return out;
+}
+
+QByteArray NetworkWorker::encode(const Message &message)
+{
+    TraceSpan span("encode", message.trace);
+    m_metrics.sent(message.type);
+    return m_serializer->Process(message);
+}
+
+bool NetworkWorker::decode(const QByteArray &payload, Message &message)
+{
+    TraceSpan span("decode");
+    QElapsedTimer timer;
+    timer.start();
+    if (!m_deserializer->ProcessOne(payload, message))
+    {
+        return false;
+    }
+    m_metrics.decoded(timer.nsecsElapsed());
+    if (Tracing::enabled())
+    {
+        span.setOp(message.trace);
+        span.setDetail(Metrics::typeName(message.type));
+    }
+    m_metrics.received(message.type);
+    return true;
+}
+
+void NetworkWorker::write(Connection* socket, const QByteArray &frame)
+{
+    m_metrics.sentBytes(frame.size());
+    socket->device()->write(frame);
+}
+
+// The process's endpoint scrapes the session from now on, under the labels it has then.
+void NetworkWorker::serveMetrics()
+{
+    if (!m_metricsServed)
+    {
+        MetricsEndpoint::instance()->add(this);
+        m_metricsServed = true;
+    }
+}
@@ -0,0 +1,282 @@
+#ifndef NETWORKWORKER_H
+#define NETWORKWORKER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QSet>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <atomic>
+
+#include "messages.h"
+#include "metrics.h"
+#include "serialization.h"
+#include "framing.h"
+#include "sessionlog.h"
+#include "outboundqueue.h"
+#include "peerregistry.h"
+#include "spscqueue.h"
+#include "transport.h"
+
+// A decoded document op for the GUI thread, or a request to answer with setSnapshot().
+struct InboundOp
+{
+    enum Kind
+    {
+        kMessage,
+        kSnapshotRequest
+    };
+
+    Kind kind = kMessage;
+    Message message;
+};
+
+// The socket side of a session: the local server or the connection to it, framing,
+// the codec, relaying and the session log. Lives on its own thread; document ops reach
+// the GUI thread already decoded through a lock-free queue, announced by opsAvailable().
+class NetworkWorker : public QObject
+{
+    Q_OBJECT
+public:
+    // Takes transport over unless it already has a parent, as a hub's has.
+    NetworkWorker(const QString& name, ISerializer* serializer, IDeserializer* deserializer, Transport* transport);
+
+    ~NetworkWorker();
+
+    // Consumer side of the inbound queue, GUI thread only. Call rearm() before draining.
+    bool takeInbound(InboundOp& op);
+
+    void rearm();
+
+    // Any thread records into these.
+    Metrics& metrics();
+
+    // The rest is worker thread only.
+    void setCompressThreshold(int bytes);
+
+    // Hosts the session headless, without a GUI thread to take snapshots from.
+    bool startHub();
+
+    // Hosts the session headless for a multi-session Hub, which owns the listening socket
+    // and hands joining peers over with addPeer().
+    void startHubSession();
+
+    // Takes over a peer whose first frame, hello, the Hub has already read from reader.
+    void addPeer(Connection* socket, QSharedPointer<FrameReader> reader, const QByteArray& hello);
+
+    QString name() const;
+
+    int peerCount() const;
+
+    // The well-known name a multi-session hub listens on; peers try it before their session name.
+    static QString hubName();
+
+    // Encodes and sends an op made on this peer.
+    void send(const Message& message);
+
+    // The GUI's answer to a kSnapshotRequest: the document as of every op it had taken
+    // from the inbound queue up to the request, and every op it had sent before answering.
+    // A client passes it on to the hub that asked.
+    void setSnapshot(const QList<Message>& messages);
+
+    // Send queue counters summed over all peers, including ones that have left.
+    OutboundQueue::Stats outboundStats() const;
+
+    quint64 droppedPeers() const;
+
+    // The session's part of a scrape of the process's metrics socket, in Prometheus text format.
+    Q_INVOKABLE QByteArray metricsText() const;
+
+public slots:
+    void start();
+
+    void stop();
+
+signals:
+    void opsAvailable();
+
+    void hosting();
+
+    // A hub session's last peer has left.
+    void deserted();
+
+private slots:
+    void newConnection();
+
+    void readyRead();
+
+    void socketError();
+
+    void disconnectFromServer();
+
+    void hostDisconnected();
+
+    void catchUpPeer();
+
+    void retrySnapshot();
+
+    void dropPeer();
+
+    void connectedToServer();
+
+    void retryFailover();
+
+    void readBroadcast();
+
+private:
+    enum FailoverState
+    {
+        kSteady,
+        kPromoting,
+        kReconnecting
+    };
+
+    Peer* attach(Connection* socket);
+
+    void drain(Connection* socket, FrameReader& reader);
+
+    QSharedPointer<FrameReader> readerFor(Connection* socket);
+
+    void handleMessage(Connection* editing_socket, const QByteArray& payload, quint64 version);
+
+    void ackedAt(quint64 version);
+
+    void absorbAckedAhead();
+
+    void repost(const QByteArray& frame);
+
+    void handleHelloMessage(Connection* socket, const HelloMessage& message);
+
+    void sendHello(bool broadcast = true);
+
+    void handleRunServerMessage(const RunServerMessage& message);
+
+    void handleServerDownMessage();
+
+    bool listen();
+
+    void openBroadcast();
+
+    void joinBroadcast(const QString& key, quint64 position);
+
+    void leaveBroadcast();
+
+    void closeBroadcastReader();
+
+    void readBroadcastUntil(quint64 until);
+
+    void beginFailover(FailoverState state, int delay = 0);
+
+    void scheduleRetry();
+
+    void probeSession();
+
+    void becomeHost();
+
+    void startWithoutHub();
+
+    void post(const InboundOp& op);
+
+    QByteArray encode(const Message& message);
+
+    bool decode(const QByteArray& payload, Message& message);
+
+    // For frames that bypass the peers' OutboundQueues.
+    void write(Connection* socket, const QByteArray& frame);
+
+    void serveMetrics();
+
+    void sendBody(Peer* peer);
+
+    void requestSnapshot();
+
+    void installSnapshot(const QList<QByteArray>& payloads);
+
+    void broadcast(const QByteArray& frame, const Peer* except = nullptr);
+
+    QByteArray frameFor(const Peer* peer, const QByteArray& frame);
+
+    void retireQueue(const Peer* peer);
+
+    void passServerRole();
+
+private:
+    // A child, so it moves to the worker thread along with the worker, unless a hub shares it.
+    Transport* m_transport;
+    bool m_listening = false;
+    // The connection to the host while this peer is a client; start() creates it.
+    Connection* m_socket = nullptr;
+
+    // Everyone connected to this peer while it hosts.
+    PeerRegistry m_peers;
+    // What has come from the host while this peer is a client.
+    QSharedPointer<FrameReader> m_hostReader;
+
+    QString m_name;
+
+    QScopedPointer<ISerializer> m_serializer;
+    QScopedPointer<IDeserializer> m_deserializer;
+
+    SpscQueue<InboundOp> m_inbound;
+    std::atomic<bool> m_notified{false};
+
+    SessionLog m_log;
+    bool m_resumed = false;
+
+    // As a client: the last host version received and the ops the host has not acknowledged yet.
+    quint64 m_lastSeen = Framing::kNoVersion;
+    QList<QByteArray> m_unacked;
+    // The first m_unappliedOps of m_unacked were wiped by a kInit; versions of our own ops
+    // acknowledged past m_lastSeen while the host had a gap in what it sent us.
+    int m_unappliedOps = 0;
+    QSet<quint64> m_ackedAhead;
+    // Joiners waiting for the snapshot requested from the GUI or, for a hub, from a donor
+    // peer, and the ops relayed since the request from anyone else, which it will not include.
+    QList<Connection*> m_awaitingSnapshot;
+    QList<QByteArray> m_sinceRequest;
+    bool m_snapshotRequested = false;
+    Connection* m_snapshotDonor = nullptr;
+    QTimer m_donorTimer;
+    // A hub session has no document until its first donor answers.
+    bool m_seeded = false;
+
+    OutboundPump m_pump;
+    OutboundQueue::Stats m_retiredStats;
+    quint64 m_droppedPeers = 0;
+
+    int m_compressThreshold = Framing::kDefaultCompressThreshold;
+    bool m_hostCompresses = false;
+
+    // Failover after the host leaves: the promoted peer retries listen() and everyone else
+    // retries connecting, both on an exponential backoff. A phase that times out falls back
+    // to the other one once (no host appeared, or someone else took the name), then gives up.
+    FailoverState m_failover = kSteady;
+    QTimer m_retryTimer;
+    QElapsedTimer m_failoverClock;
+    int m_retryDelay = 0;
+    int m_failoverTimeout = 5000;
+    bool m_fallenBack = false;
+
+    // The transport's broadcast channel, if it has one. As host: its key and how many
+    // peers read it instead of their sockets. As a client: the reader, this peer's id and
+    // a frame that came ahead of the socket.
+    QString m_broadcastKey;
+    int m_broadcastPeers = 0;
+    QScopedPointer<BroadcastReader> m_broadcast;
+    quint32 m_peerId = 0;
+    QByteArray m_held;
+    quint32 m_heldOrigin = 0;
+
+    // Served on the process's MetricsEndpoint, along with its other sessions.
+    Metrics m_metrics;
+    bool m_metricsServed = false;
+
+    bool m_serverMode = false;
+    bool m_hub = false;
+    // start() is waiting to hear whether a hub answers.
+    bool m_probingHub = false;
+};
+
+#endif // NETWORKWORKER_H
@@ -0,0 +1,230 @@
+#include "outboundqueue.h"
+#include "framing.h"
+#include "tracing.h"
+
+#include <QTimer>
+#include <QDebug>
+
+#include <algorithm>
+
+OutboundQueue::OutboundQueue(QIODevice *device, QObject *parent) :
+    QObject(parent),
+    m_device(device)
+{
+    connect(m_device, &QIODevice::bytesWritten, this, &OutboundQueue::written);
+}
+
+void OutboundQueue::setWatermarks(qint64 low, qint64 high)
+{
+    m_lowWatermark = low;
+    m_highWatermark = std::max(low, high);
+}
+
+void OutboundQueue::setMaxQueued(qint64 bytes, int max_catch_ups)
+{
+    m_maxQueued = bytes;
+    m_maxCatchUps = max_catch_ups;
+}
+
+void OutboundQueue::setPump(OutboundPump *pump)
+{
+    m_pump = pump;
+}
+
+void OutboundQueue::enqueue(const QByteArray &frame)
+{
+    // Acks keep the peer's count of its unacknowledged ops right, so they are never dropped.
+    if (m_catchingUp && !Framing::isAck(frame))
+    {
+        ++m_stats.dropped_frames;
+        return;
+    }
+    m_frames.push_back(frame);
+    m_pendingBytes += frame.size();
+    if (m_pendingBytes > m_maxQueued)
+    {
+        overflow();
+        return;
+    }
+    m_stats.peak_queued_bytes = std::max(m_stats.peak_queued_bytes, m_pendingBytes + m_device->bytesToWrite());
+    schedule();
+}
+
+void OutboundQueue::flush()
+{
+    m_blocked = false;
+    while (!m_frames.isEmpty())
+    {
+        const QByteArray frame = m_frames.takeFirst();
+        hand(frame);
+        m_device->write(frame);
+    }
+    m_pendingBytes = 0;
+}
+
+QIODevice *OutboundQueue::device() const
+{
+    return m_device;
+}
+
+bool OutboundQueue::catchingUp() const
+{
+    return m_catchingUp;
+}
+
+quint64 OutboundQueue::deliveredVersion() const
+{
+    if (!m_inFlight.isEmpty() && m_device->bytesToWrite() == 0)
+    {
+        return m_inFlight.last().second;
+    }
+    return m_deliveredVersion;
+}
+
+OutboundQueue::Stats OutboundQueue::stats() const
+{
+    Stats stats = m_stats;
+    stats.queued_bytes = m_pendingBytes + m_device->bytesToWrite();
+    stats.sent_bytes = m_handedBytes;
+    return stats;
+}
+
+void OutboundQueue::pump()
+{
+    m_scheduled = false;
+    const qint64 buffered = m_device->bytesToWrite();
+    if (m_blocked && buffered > m_lowWatermark)
+    {
+        return;
+    }
+    m_blocked = false;
+    if (m_catchingUp)
+    {
+        if (buffered > m_lowWatermark)
+        {
+            return;
+        }
+        // The acks held meanwhile go out ahead of the body.
+        m_catchingUp = false;
+        emit catchUpNeeded();
+    }
+    if (m_frames.isEmpty())
+    {
+        return;
+    }
+
+    // Each write() lands in the device's buffer, which goes out in one system call once
+    // control is back in the event loop; joining the frames first would copy them twice.
+    qint64 handed = 0;
+    while (!m_frames.isEmpty() && (handed == 0 || buffered + handed + m_frames.first().size() <= m_highWatermark))
+    {
+        const QByteArray frame = m_frames.takeFirst();
+        hand(frame);
+        m_device->write(frame);
+        handed += frame.size();
+    }
+    m_pendingBytes -= handed;
+    if (m_device->bytesToWrite() >= m_highWatermark)
+    {
+        m_blocked = true;
+    } else if (!m_frames.isEmpty())
+    {
+        schedule();
+    }
+}
+
+void OutboundQueue::written(qint64 bytes)
+{
+    m_writtenBytes += bytes;
+    while (!m_inFlight.isEmpty() && m_inFlight.first().first <= m_writtenBytes)
+    {
+        m_deliveredVersion = m_inFlight.takeFirst().second;
+    }
+    pump();
+}
+
+void OutboundQueue::hand(const QByteArray &frame)
+{
+    ++m_stats.sent_frames;
+    m_handedBytes += frame.size();
+    const quint64 version = Framing::version(frame);
+    if (version != Framing::kNoVersion)
+    {
+        m_inFlight.push_back(qMakePair(m_handedBytes, version));
+    }
+}
+
+void OutboundQueue::schedule()
+{
+    if (!m_scheduled && !m_blocked)
+    {
+        m_scheduled = true;
+        if (m_pump)
+        {
+            m_pump->schedule(this);
+        } else
+        {
+            QTimer::singleShot(0, this, &OutboundQueue::pump);
+        }
+    }
+}
+
+void OutboundQueue::overflow()
+{
+    QList<QByteArray> acks;
+    for (auto& frame : m_frames)
+    {
+        if (Framing::isAck(frame))
+        {
+            acks.push_back(frame);
+        }
+    }
+    m_stats.dropped_frames += m_frames.size() - acks.size();
+    m_frames.swap(acks);
+    m_pendingBytes = qint64(m_frames.size()) * (Framing::kHeaderSize + Framing::kVersionSize);
+    if (int(++m_stats.catch_ups) > m_maxCatchUps)
+    {
+        qDebug() << __FUNCTION__ << "peer keeps falling behind, giving up on it";
+        emit overloaded();
+        return;
+    }
+    qDebug() << __FUNCTION__ << "peer fell behind, dropping its backlog until it drains";
+    m_catchingUp = true;
+    m_blocked = m_device->bytesToWrite() > m_lowWatermark;
+    schedule();
+}
+
+OutboundPump::OutboundPump(QObject *parent) :
+    QObject(parent)
+{
+}
+
+void OutboundPump::schedule(OutboundQueue *queue)
+{
+    m_scheduled.push_back(queue);
+    if (!m_posted)
+    {
+        m_posted = true;
+        QTimer::singleShot(0, this, &OutboundPump::run);
+    }
+}
+
+// A queue that still has frames after its pump schedules itself again, for the next turn.
+void OutboundPump::run()
+{
+    m_posted = false;
+    TraceSpan span("socket write");
+    QVector<QPointer<OutboundQueue>> scheduled;
+    scheduled.swap(m_scheduled);
+    if (Tracing::enabled())
+    {
+        span.setDetail(QByteArray::number(scheduled.size()) + " queues");
+    }
+    for (auto& queue : scheduled)
+    {
+        if (queue)
+        {
+            queue->pump();
+        }
+    }
+}
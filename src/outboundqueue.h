@@ -0,0 +1,118 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QList>
+#include <QVector>
+#include <QPointer>
+#include <QByteArray>
+#include <QPair>
+
+class OutboundPump;
+
+// Per-peer send queue. Frames queued during one event loop turn are handed to the device
+// together, as the same buffers every other peer's queue holds, and nothing is handed to
+// the device while its bytesToWrite() is above the high watermark until it drains below
+// the low one.
+// A peer whose backlog exceeds the queue limit loses its queued frames, acks apart, and is
+// asked to catch up from a snapshot once it drains; after too many catch-ups it is given up on.
+class OutboundQueue : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats
+    {
+        qint64 queued_bytes = 0;
+        qint64 peak_queued_bytes = 0;
+        quint64 sent_frames = 0;
+        quint64 sent_bytes = 0;
+        quint64 dropped_frames = 0;
+        quint64 catch_ups = 0;
+    };
+
+    explicit OutboundQueue(QIODevice* device, QObject* parent = nullptr);
+
+    void setWatermarks(qint64 low, qint64 high);
+
+    void setMaxQueued(qint64 bytes, int max_catch_ups);
+
+    // Has pump schedule this queue instead of posting a timer of its own.
+    void setPump(OutboundPump* pump);
+
+    void enqueue(const QByteArray& frame);
+
+    // Hands everything queued to the device regardless of the watermarks.
+    void flush();
+
+    QIODevice* device() const;
+
+    bool catchingUp() const;
+
+    // The newest versioned frame (see Framing) the device has fully handed to the system.
+    quint64 deliveredVersion() const;
+
+    Stats stats() const;
+
+signals:
+    // The backlog was dropped and has drained; the owner should resend a snapshot.
+    void catchUpNeeded();
+
+    // The peer overflowed more than max_catch_ups times; the owner should disconnect it.
+    void overloaded();
+
+private slots:
+    void pump();
+
+    void written(qint64 bytes);
+
+private:
+    friend class OutboundPump;
+
+    void schedule();
+
+    void hand(const QByteArray& frame);
+
+    void overflow();
+
+    QIODevice* m_device;
+    OutboundPump* m_pump = nullptr;
+    QList<QByteArray> m_frames;
+    qint64 m_pendingBytes = 0;
+
+    qint64 m_lowWatermark = 256 * 1024;
+    qint64 m_highWatermark = 1024 * 1024;
+    qint64 m_maxQueued = 32 * 1024 * 1024;
+    int m_maxCatchUps = 3;
+
+    bool m_scheduled = false;
+    bool m_blocked = false;
+    bool m_catchingUp = false;
+    Stats m_stats;
+
+    // Versioned frames handed to the device, by the offset their last byte ends at.
+    QList<QPair<qint64, quint64>> m_inFlight;
+    qint64 m_handedBytes = 0;
+    qint64 m_writtenBytes = 0;
+    quint64 m_deliveredVersion = 0;
+};
+
+// Pumps the queues of all of a host's peers from one zero-timer per event loop turn. With
+// a timer per queue, relaying one op to a few hundred peers posts as many events.
+class OutboundPump : public QObject
+{
+    Q_OBJECT
+public:
+    explicit OutboundPump(QObject* parent = nullptr);
+
+    void schedule(OutboundQueue* queue);
+
+private slots:
+    void run();
+
+private:
+    QVector<QPointer<OutboundQueue>> m_scheduled;
+    bool m_posted = false;
+};
+
+#endif // OUTBOUNDQUEUE_H
@@ -0,0 +1,77 @@
+#include "peerregistry.h"
+
+PeerRegistry::PeerRegistry()
+{
+}
+
+PeerRegistry::~PeerRegistry()
+{
+    qDeleteAll(m_peers);
+}
+
+Peer *PeerRegistry::add(Connection *socket)
+{
+    Peer* peer = new Peer;
+    peer->id = m_nextId++;
+    peer->socket = socket;
+    peer->index = m_peers.size();
+    m_peers.push_back(peer);
+    m_bySocket.insert(socket, peer);
+    m_byId.insert(peer->id, peer);
+    return peer;
+}
+
+bool PeerRegistry::remove(Connection *socket)
+{
+    Peer* peer = m_bySocket.take(socket);
+    if (!peer)
+    {
+        return false;
+    }
+    m_byId.remove(peer->id);
+    Peer* last = m_peers.last();
+    m_peers[peer->index] = last;
+    last->index = peer->index;
+    m_peers.removeLast();
+    delete peer;
+    return true;
+}
+
+Peer *PeerRegistry::find(Connection *socket) const
+{
+    return m_bySocket.value(socket);
+}
+
+Peer *PeerRegistry::find(quint32 id) const
+{
+    return m_byId.value(id);
+}
+
+const QVector<Peer *> &PeerRegistry::peers() const
+{
+    return m_peers;
+}
+
+int PeerRegistry::size() const
+{
+    return m_peers.size();
+}
+
+bool PeerRegistry::isEmpty() const
+{
+    return m_peers.isEmpty();
+}
+
+QList<Connection *> PeerRegistry::takeSockets()
+{
+    QList<Connection*> sockets;
+    for (auto peer : m_peers)
+    {
+        sockets.push_back(peer->socket);
+    }
+    qDeleteAll(m_peers);
+    m_peers.clear();
+    m_bySocket.clear();
+    m_byId.clear();
+    return sockets;
+}
@@ -0,0 +1,71 @@
+#ifndef PEERREGISTRY_H
+#define PEERREGISTRY_H
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QSharedPointer>
+
+#include "framing.h"
+#include "outboundqueue.h"
+#include "transport.h"
+
+// What a host keeps for one connected peer.
+struct Peer
+{
+    // Never reused within a session; ops the peer publishes carry it as their origin.
+    quint32 id = 0;
+    Connection* socket = nullptr;
+    // Owned by the socket.
+    OutboundQueue* queue = nullptr;
+    QSharedPointer<FrameReader> reader;
+    // Said hello; only joined peers get ops.
+    bool joined = false;
+    bool compressing = false;
+    // Reads the broadcast channel instead of its socket.
+    bool broadcast = false;
+    // Gets its body once a snapshot has been taken.
+    bool awaiting_snapshot = false;
+    // Position in the registry's array.
+    int index = 0;
+};
+
+// A host's peers, in one dense array that fan-out walks without lookups. Finding a peer
+// by socket or id goes through a hash, and removal moves the last peer into the hole, so
+// adding and removing cost the same with ten peers or with hundreds. The array is not in
+// join order, and it must not change while someone walks it.
+class PeerRegistry
+{
+public:
+    PeerRegistry();
+
+    ~PeerRegistry();
+
+    Peer* add(Connection* socket);
+
+    // False if socket is not a peer.
+    bool remove(Connection* socket);
+
+    Peer* find(Connection* socket) const;
+
+    Peer* find(quint32 id) const;
+
+    const QVector<Peer*>& peers() const;
+
+    int size() const;
+
+    bool isEmpty() const;
+
+    // Forgets every peer and returns their sockets for the caller to dispose of.
+    QList<Connection*> takeSockets();
+
+private:
+    Q_DISABLE_COPY(PeerRegistry)
+
+    QVector<Peer*> m_peers;
+    QHash<Connection*, Peer*> m_bySocket;
+    QHash<quint32, Peer*> m_byId;
+    quint32 m_nextId = 1;
+};
+
+#endif // PEERREGISTRY_H
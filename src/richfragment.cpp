@@ -0,0 +1,417 @@
+#include "richfragment.h"
+
+#include <QDataStream>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextList>
+#include <QVector>
+#include <QDebug>
+
+#include <algorithm>
+
+namespace
+{
+    const QDataStream::Version kStreamVersion = QDataStream::Qt_5_15;
+
+    struct Run
+    {
+        quint32 length;
+        quint64 format;
+    };
+
+    enum ListKind : quint8
+    {
+        kNoList,
+        kExistingList,
+        kNewList
+    };
+
+    // Format and list membership of a paragraph written by the fragment.
+    // kExistingList joins the list of the block at anchor, kNewList joins
+    // the list_index-th list created by this fragment.
+    struct Block
+    {
+        quint64 format = 0;
+        quint8 list = kNoList;
+        qint32 anchor = 0;
+        quint32 list_index = 0;
+        quint64 list_format = 0;
+    };
+
+    QDataStream& operator<<(QDataStream& stream, const Block& block)
+    {
+        stream << block.format << block.list;
+        if (block.list == kExistingList)
+        {
+            stream << block.anchor;
+        } else if (block.list == kNewList)
+        {
+            stream << block.list_index << block.list_format;
+        }
+        return stream;
+    }
+
+    QDataStream& operator>>(QDataStream& stream, Block& block)
+    {
+        stream >> block.format >> block.list;
+        if (block.list == kExistingList)
+        {
+            stream >> block.anchor;
+        } else if (block.list == kNewList)
+        {
+            stream >> block.list_index >> block.list_format;
+        }
+        return stream;
+    }
+
+    class BlockEncoder
+    {
+    public:
+        BlockEncoder(int position, int end, bool later_anchors, FormatTable& formats, FormatTable::Definitions& definitions) :
+            m_position(position), m_end(end), m_laterAnchors(later_anchors), m_formats(formats), m_definitions(definitions)
+        {}
+
+        Block encode(const QTextBlock& text_block)
+        {
+            QTextBlockFormat format = text_block.blockFormat();
+            format.clearProperty(QTextFormat::ObjectIndex);
+            Block block;
+            block.format = m_formats.intern(format, m_definitions);
+
+            QTextList* list = text_block.textList();
+            if (!list)
+            {
+                return block;
+            }
+            auto known = m_lists.constFind(list);
+            if (known == m_lists.constEnd())
+            {
+                known = m_lists.insert(list, describe(list));
+            }
+            Block result = known.value();
+            result.format = block.format;
+            return result;
+        }
+
+    private:
+        Block describe(QTextList* list)
+        {
+            Block block;
+            for (int i = 0; i < list->count(); ++i)
+            {
+                const int start = list->item(i).position();
+                if (start < m_position || (m_laterAnchors && start > m_end))
+                {
+                    block.list = kExistingList;
+                    block.anchor = start;
+                    return block;
+                }
+            }
+            block.list = kNewList;
+            block.list_index = m_newLists++;
+            block.list_format = m_formats.intern(list->format(), m_definitions);
+            return block;
+        }
+
+        int m_position;
+        int m_end;
+        bool m_laterAnchors;
+        FormatTable& m_formats;
+        FormatTable::Definitions& m_definitions;
+        QHash<QTextList*, Block> m_lists;
+        quint32 m_newLists = 0;
+    };
+
+    // FNV-1a, so every peer derives the same id whatever Qt it was built against.
+    quint64 formatId(const QByteArray& definition)
+    {
+        quint64 hash = Q_UINT64_C(0xcbf29ce484222325);
+        for (char byte : definition)
+        {
+            hash = (hash ^ quint8(byte)) * Q_UINT64_C(0x100000001b3);
+        }
+        return hash;
+    }
+
+    void appendRun(QVector<Run>& runs, int length, quint64 format)
+    {
+        if (!runs.isEmpty() && runs.last().format == format)
+        {
+            runs.last().length += length;
+        } else
+        {
+            Run run = {quint32(length), format};
+            runs.push_back(run);
+        }
+    }
+}
+
+quint64 FormatTable::intern(const QTextFormat &format, Definitions &new_definitions)
+{
+    const QByteArray definition = RichFragment::saveFormat(format);
+    const quint64 id = formatId(definition);
+    if (!m_announced.contains(id))
+    {
+        m_announced.insert(id);
+        m_definitions.insert(id, definition);
+        m_formats.insert(id, format);
+        new_definitions.push_back(qMakePair(id, definition));
+    }
+    return id;
+}
+
+void FormatTable::define(quint64 id, const QByteArray &definition, bool announced)
+{
+    if (!m_definitions.contains(id))
+    {
+        m_definitions.insert(id, definition);
+    }
+    if (announced)
+    {
+        m_announced.insert(id);
+    }
+}
+
+QTextFormat FormatTable::format(quint64 id) const
+{
+    auto cached = m_formats.constFind(id);
+    if (cached != m_formats.constEnd())
+    {
+        return cached.value();
+    }
+    auto definition = m_definitions.constFind(id);
+    if (definition == m_definitions.constEnd())
+    {
+        qDebug() << __FUNCTION__ << "unknown format" << id;
+        return QTextFormat();
+    }
+    const QTextFormat format = RichFragment::loadFormat(definition.value());
+    m_formats.insert(id, format);
+    return format;
+}
+
+QByteArray FormatTable::save() const
+{
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+    stream.setVersion(kStreamVersion);
+    stream << quint32(m_announced.size());
+    for (auto id : m_announced)
+    {
+        stream << id << m_definitions.value(id);
+    }
+    return result;
+}
+
+void FormatTable::load(const QByteArray &data)
+{
+    QDataStream stream(data);
+    stream.setVersion(kStreamVersion);
+    m_announced.clear();
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+    {
+        quint64 id = 0;
+        QByteArray definition;
+        stream >> id >> definition;
+        define(id, definition);
+    }
+}
+
+QByteArray RichFragment::saveFormat(const QTextFormat &format)
+{
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+    stream.setVersion(kStreamVersion);
+    stream << format;
+    return result;
+}
+
+QTextFormat RichFragment::loadFormat(const QByteArray &data)
+{
+    QTextFormat format;
+    QDataStream stream(data);
+    stream.setVersion(kStreamVersion);
+    stream >> format;
+    return format;
+}
+
+QByteArray RichFragment::encode(QTextDocument *document, int position, int length, FormatTable &formats, bool later_anchors)
+{
+    const int end = position + length;
+    FormatTable::Definitions definitions;
+    BlockEncoder block_encoder(position, end, later_anchors, formats, definitions);
+    QHash<int, quint64> char_ids;
+    QString text;
+    QVector<Run> runs;
+    QVector<Block> blocks;
+
+    QTextBlock block = document->findBlock(position);
+    blocks.push_back(block_encoder.encode(block));
+    for (; block.isValid() && block.position() < end; block = block.next())
+    {
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it)
+        {
+            QTextFragment fragment = it.fragment();
+            const int from = std::max(fragment.position(), position);
+            const int to = std::min(fragment.position() + fragment.length(), end);
+            if (from >= to)
+            {
+                continue;
+            }
+            auto id = char_ids.constFind(fragment.charFormatIndex());
+            if (id == char_ids.constEnd())
+            {
+                id = char_ids.insert(fragment.charFormatIndex(), formats.intern(fragment.charFormat(), definitions));
+            }
+            text += fragment.text().mid(from - fragment.position(), to - from);
+            appendRun(runs, to - from, id.value());
+        }
+
+        const int separator = block.position() + block.length() - 1;
+        if (separator >= position && separator < end && block.next().isValid())
+        {
+            QTextBlock next = block.next();
+            text += QChar(QChar::ParagraphSeparator);
+            appendRun(runs, 1, formats.intern(next.charFormat(), definitions));
+            blocks.push_back(block_encoder.encode(next));
+        }
+    }
+
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+    stream.setVersion(kStreamVersion);
+    stream << quint32(definitions.size());
+    for (auto& definition : definitions)
+    {
+        stream << definition.first << definition.second;
+    }
+    stream << text.toUtf8();
+    stream << quint32(runs.size());
+    for (auto& run : runs)
+    {
+        stream << run.length << run.format;
+    }
+    stream << quint32(blocks.size());
+    for (auto& id : blocks)
+    {
+        stream << id;
+    }
+    return result;
+}
+
+bool RichFragment::apply(QTextCursor &cursor, const QByteArray &fragment, FormatTable &formats, bool announced)
+{
+    QDataStream stream(fragment);
+    stream.setVersion(kStreamVersion);
+
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+    {
+        quint64 id = 0;
+        QByteArray definition;
+        stream >> id >> definition;
+        formats.define(id, definition, announced);
+    }
+
+    QByteArray utf8;
+    stream >> utf8;
+    const QString text = QString::fromUtf8(utf8);
+
+    QVector<Run> runs;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+    {
+        Run run = {0, 0};
+        stream >> run.length >> run.format;
+        runs.push_back(run);
+    }
+
+    QVector<Block> blocks;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+    {
+        Block block;
+        stream >> block;
+        blocks.push_back(block);
+    }
+
+    if (stream.status() != QDataStream::Ok || blocks.isEmpty())
+    {
+        qDebug() << __FUNCTION__ << "malformed fragment" << fragment.size();
+        return false;
+    }
+
+    // Paragraphs whose format this fragment decides, paired with their index in blocks.
+    QVector<QPair<QTextBlock, int>> written;
+    if (cursor.atBlockStart())
+    {
+        cursor.setBlockFormat(formats.format(blocks[0].format).toBlockFormat());
+        written.push_back(qMakePair(cursor.block(), 0));
+    }
+
+    int offset = 0;
+    int block_index = 0;
+    for (auto& run : runs)
+    {
+        const QTextCharFormat format = formats.format(run.format).toCharFormat();
+        const int run_end = std::min(offset + int(run.length), text.size());
+        while (offset < run_end)
+        {
+            int separator = text.indexOf(QChar(QChar::ParagraphSeparator), offset);
+            if (separator == -1 || separator >= run_end)
+            {
+                separator = run_end;
+            }
+            if (separator > offset)
+            {
+                cursor.insertText(text.mid(offset, separator - offset), format);
+            }
+            if (separator < run_end)
+            {
+                ++block_index;
+                QTextBlockFormat block_format = block_index < blocks.size()
+                        ? formats.format(blocks[block_index].format).toBlockFormat()
+                        : QTextBlockFormat();
+                cursor.insertBlock(block_format, format);
+                if (block_index < blocks.size())
+                {
+                    written.push_back(qMakePair(cursor.block(), block_index));
+                }
+                ++separator;
+            }
+            offset = separator;
+        }
+    }
+
+    // List membership is restored once all text is in, so anchors refer to the final layout.
+    QTextDocument* document = cursor.document();
+    QHash<quint32, QTextList*> new_lists;
+    for (auto& item : written)
+    {
+        const Block& block = blocks[item.second];
+        if (block.list == kExistingList)
+        {
+            QTextList* list = document->findBlock(block.anchor).textList();
+            if (list)
+            {
+                list->add(item.first);
+            }
+        } else if (block.list == kNewList)
+        {
+            QTextList* list = new_lists.value(block.list_index);
+            if (list)
+            {
+                list->add(item.first);
+            } else
+            {
+                QTextCursor list_cursor(item.first);
+                new_lists.insert(block.list_index, list_cursor.createList(formats.format(block.list_format).toListFormat()));
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef RICHFRAGMENT_H
+#define RICHFRAGMENT_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QSet>
+#include <QTextFormat>
+
+QT_BEGIN_NAMESPACE
+class QTextCursor;
+class QTextDocument;
+QT_END_NAMESPACE
+
+// Session-wide table of text formats keyed by a hash of their serialized form.
+// A format is announced once, the first time somebody uses it in an op that all
+// peers receive; every peer (and every joiner, through kInit) keeps the announced
+// definitions. Definitions that only travelled inside a snapshot are kept for
+// decoding but not treated as announced.
+// An op announcing a format may never make it into the session, so load() (kInit)
+// resets the announced set to the body's; formats missing from it are announced again.
+class FormatTable
+{
+public:
+    typedef QList<QPair<quint64, QByteArray>> Definitions;
+
+    quint64 intern(const QTextFormat& format, Definitions& new_definitions);
+
+    void define(quint64 id, const QByteArray& definition, bool announced = true);
+
+    QTextFormat format(quint64 id) const;
+
+    QByteArray save() const;
+
+    void load(const QByteArray& data);
+
+private:
+    QHash<quint64, QByteArray> m_definitions;
+    QSet<quint64> m_announced;
+    mutable QHash<quint64, QTextFormat> m_formats;
+};
+
+// Plain text plus run-length char format spans, and the format and list membership
+// of the first paragraph and of every paragraph started inside the fragment.
+namespace RichFragment
+{
+    QByteArray saveFormat(const QTextFormat& format);
+
+    QTextFormat loadFormat(const QByteArray& data);
+
+    // With later_anchors = false, paragraphs only ever join lists that start before the
+    // fragment, so it can be applied before the rest of the document (snapshot chunks).
+    QByteArray encode(QTextDocument* document, int position, int length, FormatTable& formats, bool later_anchors = true);
+
+    // Pass announced = false for snapshot chunks, which only the joiner receives.
+    bool apply(QTextCursor& cursor, const QByteArray& fragment, FormatTable& formats, bool announced = true);
+}
+
+#endif // RICHFRAGMENT_H
@@ -1,39 +1,536 @@
 #include "serialization.h"
+#include "framing.h"
 
-QByteArray JsonSerializer::Process(const QVariantMap &data)
+#include <QDataStream>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+const QString MessageField::TYPE = "type";
+const QString MessageField::POSITION = "position";
+const QString MessageField::REMOVED = "removed";
+const QString MessageField::ADDED = "added";
+const QString MessageField::VALUE = "value";
+const QString MessageField::BOLD = "bold";
+const QString MessageField::UNDERLINE = "underline";
+const QString MessageField::ITALIC = "italic";
+const QString MessageField::FAMILY = "family";
+const QString MessageField::SIZE = "size";
+const QString MessageField::COLOR = "color";
+const QString MessageField::FRAGMENT = "fragment";
+const QString MessageField::FORMATS = "formats";
+const QString MessageField::LENGTH = "length";
+const QString MessageField::SIZE_ADJUSTMENT = "sizeAdjustment";
+const QString MessageField::BLOCK_FORMAT = "blockFormat";
+const QString MessageField::LIST_FORMAT = "listFormat";
+const QString MessageField::CHUNKS = "chunks";
+const QString MessageField::CAPABILITIES = "capabilities";
+const QString MessageField::RESUME = "resume";
+const QString MessageField::VERSION = "version";
+const QString MessageField::TAIL = "tail";
+const QString MessageField::PAYLOADS = "payloads";
+const QString MessageField::SESSION = "session";
+const QString MessageField::PEER = "peer";
+const QString MessageField::BROADCAST = "broadcast";
+const QString MessageField::TRACE = "trace";
+
+const QString MessageValue::NONE = "none";
+
+namespace
 {
-    return QJsonDocument::fromVariant(data).toJson(QJsonDocument::Compact);
-}
+    const QDataStream::Version kStreamVersion = QDataStream::Qt_5_15;
 
+    void writeString(QDataStream& stream, const QString& text)
+    {
+        stream << text.toUtf8();
+    }
+
+    QString readString(QDataStream& stream)
+    {
+        QByteArray utf8;
+        stream >> utf8;
+        return QString::fromUtf8(utf8);
+    }
+
+    QString toWire(const QString& text)
+    {
+        return text.isEmpty() ? MessageValue::NONE : text;
+    }
+
+    QString fromWire(const QString& text)
+    {
+        return text == MessageValue::NONE ? QString() : text;
+    }
+
+    QString bytesToWire(const QByteArray& data)
+    {
+        return QString::fromLatin1(data.toBase64());
+    }
+
+    QByteArray bytesFromWire(const QJsonValue& value)
+    {
+        return QByteArray::fromBase64(value.toString().toLatin1());
+    }
+
+    void writeFormat(QJsonObject& object, const CharFormatMessage& format)
+    {
+        object[MessageField::POSITION] = format.position;
+        object[MessageField::LENGTH] = format.length;
+        if (format.properties & CharFormatMessage::kBold)
+            object[MessageField::BOLD] = format.bold;
+        if (format.properties & CharFormatMessage::kUnderline)
+            object[MessageField::UNDERLINE] = format.underline;
+        if (format.properties & CharFormatMessage::kItalic)
+            object[MessageField::ITALIC] = format.italic;
+        if (format.properties & CharFormatMessage::kFamily)
+            object[MessageField::FAMILY] = format.family;
+        if (format.properties & CharFormatMessage::kSize)
+            object[MessageField::SIZE] = format.size;
+        if (format.properties & CharFormatMessage::kColor)
+            object[MessageField::COLOR] = QString("#%1").arg(format.color, 8, 16, QChar('0'));
+        if (format.properties & CharFormatMessage::kSizeAdjustment)
+            object[MessageField::SIZE_ADJUSTMENT] = format.size_adjustment;
+    }
+
+    void readFormat(const QJsonObject& object, CharFormatMessage& format)
+    {
+        format.position = object.value(MessageField::POSITION).toInt();
+        format.length = object.value(MessageField::LENGTH).toInt();
+        format.properties = 0;
+        if (object.contains(MessageField::BOLD))
+        {
+            format.properties |= CharFormatMessage::kBold;
+            format.bold = object.value(MessageField::BOLD).toBool();
+        }
+        if (object.contains(MessageField::UNDERLINE))
+        {
+            format.properties |= CharFormatMessage::kUnderline;
+            format.underline = object.value(MessageField::UNDERLINE).toBool();
+        }
+        if (object.contains(MessageField::ITALIC))
+        {
+            format.properties |= CharFormatMessage::kItalic;
+            format.italic = object.value(MessageField::ITALIC).toBool();
+        }
+        if (object.contains(MessageField::FAMILY))
+        {
+            format.properties |= CharFormatMessage::kFamily;
+            format.family = object.value(MessageField::FAMILY).toString();
+        }
+        if (object.contains(MessageField::SIZE))
+        {
+            format.properties |= CharFormatMessage::kSize;
+            format.size = object.value(MessageField::SIZE).toDouble();
+        }
+        if (object.contains(MessageField::COLOR))
+        {
+            format.properties |= CharFormatMessage::kColor;
+            format.color = object.value(MessageField::COLOR).toString().mid(1).toUInt(nullptr, 16);
+        }
+        if (object.contains(MessageField::SIZE_ADJUSTMENT))
+        {
+            format.properties |= CharFormatMessage::kSizeAdjustment;
+            format.size_adjustment = object.value(MessageField::SIZE_ADJUSTMENT).toInt();
+        }
+    }
+
+    void writeFormat(QDataStream& stream, const CharFormatMessage& format)
+    {
+        stream << qint32(format.position) << qint32(format.length) << quint8(format.properties);
+        if (format.properties & CharFormatMessage::kBold)
+            stream << format.bold;
+        if (format.properties & CharFormatMessage::kUnderline)
+            stream << format.underline;
+        if (format.properties & CharFormatMessage::kItalic)
+            stream << format.italic;
+        if (format.properties & CharFormatMessage::kFamily)
+            writeString(stream, format.family);
+        if (format.properties & CharFormatMessage::kSize)
+            stream << format.size;
+        if (format.properties & CharFormatMessage::kColor)
+            stream << format.color;
+        if (format.properties & CharFormatMessage::kSizeAdjustment)
+            stream << qint32(format.size_adjustment);
+    }
+
+    void readFormat(QDataStream& stream, CharFormatMessage& format)
+    {
+        qint32 position = 0;
+        qint32 length = 0;
+        quint8 properties = 0;
+        stream >> position >> length >> properties;
+        format.position = position;
+        format.length = length;
+        format.properties = properties;
+        if (format.properties & CharFormatMessage::kBold)
+            stream >> format.bold;
+        if (format.properties & CharFormatMessage::kUnderline)
+            stream >> format.underline;
+        if (format.properties & CharFormatMessage::kItalic)
+            stream >> format.italic;
+        if (format.properties & CharFormatMessage::kFamily)
+            format.family = readString(stream);
+        if (format.properties & CharFormatMessage::kSize)
+            stream >> format.size;
+        if (format.properties & CharFormatMessage::kColor)
+            stream >> format.color;
+        if (format.properties & CharFormatMessage::kSizeAdjustment)
+        {
+            qint32 size_adjustment = 0;
+            stream >> size_adjustment;
+            format.size_adjustment = size_adjustment;
+        }
+    }
 
-QList<QVariantMap> JsonDeserializer::Process(const QByteArray &data)
+    QList<Message> processFrames(IDeserializer& deserializer, const QByteArray& data)
+    {
+        QList<Message> result;
+        FrameReader reader;
+        reader.append(data);
+        QByteArray payload;
+        while (reader.next(payload))
+        {
+            Message message;
+            if (deserializer.ProcessOne(payload, message))
+            {
+                result.push_back(message);
+            }
+        }
+        return result;
+    }
+}
+
+QByteArray JsonSerializer::Process(const Message &message)
 {
-    QList<QVariantMap> result;
-    QList<QByteArray> messages;
-    int start_pos = 0;
-    int end_pos = data.indexOf("}{");
-    while (end_pos != -1)
+    QJsonObject object;
+    object[MessageField::TYPE] = int(message.type);
+    switch (message.type)
     {
-        messages.push_back(data.mid(start_pos, end_pos - start_pos + 1));
-        start_pos = end_pos + 1;
-        end_pos = data.indexOf("}{", start_pos);
+        case kInit:
+            object[MessageField::VALUE] = toWire(message.init.html);
+            object[MessageField::FORMATS] = bytesToWire(message.init.formats);
+            object[MessageField::FRAGMENT] = bytesToWire(message.init.fragment);
+            object[MessageField::CHUNKS] = message.init.chunks;
+            break;
+        case kHello:
+            object[MessageField::CAPABILITIES] = message.hello.capabilities;
+            object[MessageField::RESUME] = message.hello.resume;
+            object[MessageField::VERSION] = QString::number(message.hello.version);
+            object[MessageField::SESSION] = message.hello.session;
+            object[MessageField::PEER] = qint64(message.hello.peer);
+            object[MessageField::BROADCAST] = message.hello.broadcast;
+            object[MessageField::POSITION] = QString::number(message.hello.position);
+            break;
+        case kRunServer:
+        {
+            QJsonArray tail;
+            for (auto& frame : message.run_server.tail)
+            {
+                tail.append(bytesToWire(frame));
+            }
+            object[MessageField::VERSION] = QString::number(message.run_server.version);
+            object[MessageField::TAIL] = tail;
+            break;
+        }
+        case kSnapshot:
+        {
+            QJsonArray payloads;
+            for (auto& payload : message.snapshot.payloads)
+            {
+                payloads.append(bytesToWire(payload));
+            }
+            object[MessageField::PAYLOADS] = payloads;
+            break;
+        }
+        case kInitChunk:
+            object[MessageField::FRAGMENT] = bytesToWire(message.init.fragment);
+            break;
+        case kContentChangedWithHtml:
+            object[MessageField::POSITION] = message.content.position;
+            object[MessageField::REMOVED] = message.content.removed;
+            object[MessageField::ADDED] = toWire(message.content.added);
+            break;
+        case kContentChangedWithPlain:
+            // Typed text may well be "none", so it goes as it is, empty included.
+            object[MessageField::POSITION] = message.content.position;
+            object[MessageField::REMOVED] = message.content.removed;
+            object[MessageField::ADDED] = message.content.added;
+            break;
+        case kContentChangedWithFragment:
+            object[MessageField::POSITION] = message.content.position;
+            object[MessageField::REMOVED] = message.content.removed;
+            object[MessageField::FRAGMENT] = bytesToWire(message.content.fragment);
+            break;
+        case kStyleChanged:
+            object[MessageField::POSITION] = message.style.position;
+            object[MessageField::LENGTH] = message.style.length;
+            object[MessageField::BLOCK_FORMAT] = bytesToWire(message.style.block_format);
+            object[MessageField::LIST_FORMAT] = bytesToWire(message.style.list_format);
+            break;
+        case kReset:
+            object[MessageField::ADDED] = toWire(message.reset.html);
+            break;
+        case kCharFormatChanged:
+            writeFormat(object, message.format);
+            break;
+        case kSnapshotRequest:
+            object[MessageField::VERSION] = QString::number(message.snapshot.version);
+            break;
+        case kServerDown:
+            break;
     }
-    messages.push_back(data.mid(start_pos));
-    for (auto& message : messages)
+    if (message.trace != 0)
     {
-        result.push_back(ProcessOne(message));
+        object[MessageField::TRACE] = QString::number(message.trace);
     }
-    return result;
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+
+QList<Message> JsonDeserializer::Process(const QByteArray &data)
+{
+    return processFrames(*this, data);
 }
 
-QVariantMap JsonDeserializer::ProcessOne(const QByteArray &data)
+bool JsonDeserializer::ProcessOne(const QByteArray &data, Message &message)
 {
     QJsonParseError parse_error;
-    QVariantMap result = QJsonDocument::fromJson(data, &parse_error).toVariant().toMap();
+    QJsonObject object = QJsonDocument::fromJson(data, &parse_error).object();
     if (parse_error.error != QJsonParseError::NoError)
     {
         qDebug() << __FUNCTION__ << parse_error.errorString() << '\n' << data;
-        return QVariantMap();
+        return false;
+    }
+    message.type = MessageType(object.value(MessageField::TYPE).toInt());
+    switch (message.type)
+    {
+        case kInit:
+            message.init.html = fromWire(object.value(MessageField::VALUE).toString());
+            message.init.formats = bytesFromWire(object.value(MessageField::FORMATS));
+            message.init.fragment = bytesFromWire(object.value(MessageField::FRAGMENT));
+            message.init.chunks = object.value(MessageField::CHUNKS).toInt(1);
+            break;
+        case kHello:
+            message.hello.capabilities = object.value(MessageField::CAPABILITIES).toInt();
+            message.hello.resume = object.value(MessageField::RESUME).toBool();
+            message.hello.version = object.value(MessageField::VERSION).toString().toULongLong();
+            message.hello.session = object.value(MessageField::SESSION).toString();
+            message.hello.peer = quint32(object.value(MessageField::PEER).toDouble());
+            message.hello.broadcast = object.value(MessageField::BROADCAST).toString();
+            message.hello.position = object.value(MessageField::POSITION).toString().toULongLong();
+            break;
+        case kRunServer:
+            message.run_server.version = object.value(MessageField::VERSION).toString().toULongLong();
+            for (auto frame : object.value(MessageField::TAIL).toArray())
+            {
+                message.run_server.tail.push_back(bytesFromWire(frame));
+            }
+            break;
+        case kSnapshot:
+            for (auto payload : object.value(MessageField::PAYLOADS).toArray())
+            {
+                message.snapshot.payloads.push_back(bytesFromWire(payload));
+            }
+            break;
+        case kInitChunk:
+            message.init.fragment = bytesFromWire(object.value(MessageField::FRAGMENT));
+            break;
+        case kContentChangedWithHtml:
+            message.content.position = object.value(MessageField::POSITION).toInt();
+            message.content.removed = object.value(MessageField::REMOVED).toInt();
+            message.content.added = fromWire(object.value(MessageField::ADDED).toString());
+            break;
+        case kContentChangedWithPlain:
+            message.content.position = object.value(MessageField::POSITION).toInt();
+            message.content.removed = object.value(MessageField::REMOVED).toInt();
+            message.content.added = object.value(MessageField::ADDED).toString();
+            break;
+        case kContentChangedWithFragment:
+            message.content.position = object.value(MessageField::POSITION).toInt();
+            message.content.removed = object.value(MessageField::REMOVED).toInt();
+            message.content.fragment = bytesFromWire(object.value(MessageField::FRAGMENT));
+            break;
+        case kStyleChanged:
+            message.style.position = object.value(MessageField::POSITION).toInt();
+            message.style.length = object.value(MessageField::LENGTH).toInt();
+            message.style.block_format = bytesFromWire(object.value(MessageField::BLOCK_FORMAT));
+            message.style.list_format = bytesFromWire(object.value(MessageField::LIST_FORMAT));
+            break;
+        case kReset:
+            message.reset.html = fromWire(object.value(MessageField::ADDED).toString());
+            break;
+        case kCharFormatChanged:
+            readFormat(object, message.format);
+            break;
+        case kSnapshotRequest:
+            message.snapshot.version = object.value(MessageField::VERSION).toString().toULongLong();
+            break;
+        case kServerDown:
+            break;
+        default:
+            qDebug() << __FUNCTION__ << "unknown message type" << message.type;
+            return false;
+    }
+    message.trace = object.value(MessageField::TRACE).toString().toULongLong();
+    return true;
+}
+
+
+QByteArray BinarySerializer::Process(const Message &message)
+{
+    QByteArray result;
+    QDataStream stream(&result, QIODevice::WriteOnly);
+    stream.setVersion(kStreamVersion);
+    stream << quint8(message.type);
+    switch (message.type)
+    {
+        case kInit:
+            writeString(stream, message.init.html);
+            stream << message.init.formats << message.init.fragment << qint32(message.init.chunks);
+            break;
+        case kHello:
+            stream << qint32(message.hello.capabilities) << message.hello.resume << message.hello.version;
+            writeString(stream, message.hello.session);
+            stream << message.hello.peer;
+            writeString(stream, message.hello.broadcast);
+            stream << message.hello.position;
+            break;
+        case kRunServer:
+            stream << message.run_server.version << message.run_server.tail;
+            break;
+        case kSnapshot:
+            stream << message.snapshot.payloads;
+            break;
+        case kInitChunk:
+            stream << message.init.fragment;
+            break;
+        case kContentChangedWithHtml:
+        case kContentChangedWithPlain:
+            stream << qint32(message.content.position) << qint32(message.content.removed);
+            writeString(stream, message.content.added);
+            break;
+        case kContentChangedWithFragment:
+            stream << qint32(message.content.position) << qint32(message.content.removed);
+            stream << message.content.fragment;
+            break;
+        case kStyleChanged:
+            stream << qint32(message.style.position) << qint32(message.style.length);
+            stream << message.style.block_format << message.style.list_format;
+            break;
+        case kReset:
+            writeString(stream, message.reset.html);
+            break;
+        case kCharFormatChanged:
+            writeFormat(stream, message.format);
+            break;
+        case kSnapshotRequest:
+            stream << message.snapshot.version;
+            break;
+        case kServerDown:
+            break;
+    }
+    // Optional and last, so peers that do not trace need not know about it.
+    if (message.trace != 0)
+    {
+        stream << message.trace;
     }
     return result;
 }
+
+
+QList<Message> BinaryDeserializer::Process(const QByteArray &data)
+{
+    return processFrames(*this, data);
+}
+
+bool BinaryDeserializer::ProcessOne(const QByteArray &data, Message &message)
+{
+    QDataStream stream(data);
+    stream.setVersion(kStreamVersion);
+    quint8 type = 0;
+    stream >> type;
+    message.type = MessageType(type);
+    switch (message.type)
+    {
+        case kInit:
+        {
+            qint32 chunks = 1;
+            message.init.html = readString(stream);
+            stream >> message.init.formats >> message.init.fragment >> chunks;
+            message.init.chunks = chunks;
+            break;
+        }
+        case kHello:
+        {
+            qint32 capabilities = 0;
+            stream >> capabilities >> message.hello.resume >> message.hello.version;
+            message.hello.capabilities = capabilities;
+            message.hello.session = readString(stream);
+            stream >> message.hello.peer;
+            message.hello.broadcast = readString(stream);
+            stream >> message.hello.position;
+            break;
+        }
+        case kRunServer:
+            stream >> message.run_server.version >> message.run_server.tail;
+            break;
+        case kSnapshot:
+            stream >> message.snapshot.payloads;
+            break;
+        case kInitChunk:
+            stream >> message.init.fragment;
+            break;
+        case kContentChangedWithHtml:
+        case kContentChangedWithPlain:
+        case kContentChangedWithFragment:
+        {
+            qint32 position = 0;
+            qint32 removed = 0;
+            stream >> position >> removed;
+            message.content.position = position;
+            message.content.removed = removed;
+            if (message.type == kContentChangedWithFragment)
+            {
+                stream >> message.content.fragment;
+            } else
+            {
+                message.content.added = readString(stream);
+            }
+            break;
+        }
+        case kStyleChanged:
+        {
+            qint32 position = 0;
+            qint32 length = 0;
+            stream >> position >> length;
+            message.style.position = position;
+            message.style.length = length;
+            stream >> message.style.block_format >> message.style.list_format;
+            break;
+        }
+        case kReset:
+            message.reset.html = readString(stream);
+            break;
+        case kCharFormatChanged:
+            readFormat(stream, message.format);
+            break;
+        case kSnapshotRequest:
+            stream >> message.snapshot.version;
+            break;
+        case kServerDown:
+            break;
+        default:
+            qDebug() << __FUNCTION__ << "unknown message type" << type;
+            return false;
+    }
+    if (!stream.atEnd())
+    {
+        stream >> message.trace;
+    }
+    if (stream.status() != QDataStream::Ok)
+    {
+        qDebug() << __FUNCTION__ << "malformed message" << data.size();
+        return false;
+    }
+    return true;
+}
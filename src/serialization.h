@@ -2,38 +2,91 @@
 #define SERIALIZATION_H
 
 #include <QByteArray>
-#include <QVariantMap>
+#include <QList>
 #include <QJsonDocument>
 
+#include "messages.h"
+
+struct MessageField
+{
+    static const QString TYPE;
+    static const QString POSITION;
+    static const QString REMOVED;
+    static const QString ADDED;
+    static const QString VALUE;
+    static const QString BOLD;
+    static const QString UNDERLINE;
+    static const QString ITALIC;
+    static const QString FAMILY;
+    static const QString SIZE;
+    static const QString COLOR;
+    static const QString FRAGMENT;
+    static const QString FORMATS;
+    static const QString LENGTH;
+    static const QString SIZE_ADJUSTMENT;
+    static const QString BLOCK_FORMAT;
+    static const QString LIST_FORMAT;
+    static const QString CHUNKS;
+    static const QString CAPABILITIES;
+    static const QString RESUME;
+    static const QString VERSION;
+    static const QString TAIL;
+    static const QString PAYLOADS;
+    static const QString SESSION;
+    static const QString PEER;
+    static const QString BROADCAST;
+    static const QString TRACE;
+};
+
+struct MessageValue
+{
+    static const QString NONE;
+};
+
 class ISerializer
 {
 public:
-    virtual QByteArray Process(const QVariantMap& data) = 0;
+    virtual QByteArray Process(const Message& message) = 0;
     virtual ~ISerializer() {}
 };
 
 class IDeserializer
 {
 public:
-    virtual QList<QVariantMap> Process(const QByteArray& data) = 0;
-    virtual QVariantMap ProcessOne(const QByteArray& data) = 0;
+    virtual QList<Message> Process(const QByteArray& data) = 0;
+    virtual bool ProcessOne(const QByteArray& data, Message& message) = 0;
     virtual ~IDeserializer() {}
 };
 
 class JsonSerializer : public ISerializer
 {
 public:
-    QByteArray Process(const QVariantMap& data) override;
+    QByteArray Process(const Message& message) override;
     ~JsonSerializer(){}
 };
 
 class JsonDeserializer : public IDeserializer
 {
 public:
-    QList<QVariantMap> Process(const QByteArray& data) override;
+    QList<Message> Process(const QByteArray& data) override;
+    bool ProcessOne(const QByteArray& data, Message& message) override;
     ~JsonDeserializer(){}
-private:
-    QVariantMap ProcessOne(const QByteArray& data) override;
+};
+
+// Compact QDataStream encoding: a one-byte type followed by that type's fields in a fixed order.
+class BinarySerializer : public ISerializer
+{
+public:
+    QByteArray Process(const Message& message) override;
+    ~BinarySerializer(){}
+};
+
+class BinaryDeserializer : public IDeserializer
+{
+public:
+    QList<Message> Process(const QByteArray& data) override;
+    bool ProcessOne(const QByteArray& data, Message& message) override;
+    ~BinaryDeserializer(){}
 };
 
 #endif // SERIALIZATION_H
@@ -0,0 +1,118 @@
+#include "sessionlog.h"
+
+void SessionLog::append(const QByteArray &frame)
+{
+    ++m_version;
+    m_tail.push_back(frame);
+    m_tailBytes += frame.size();
+    trim();
+}
+
+bool SessionLog::hasFreshSnapshot() const
+{
+    return !m_snapshot.isEmpty() && m_snapshotVersion >= m_tailBase;
+}
+
+bool SessionLog::needsSnapshot() const
+{
+    return m_keepHistory && overLimits();
+}
+
+void SessionLog::setSnapshot(const QList<QByteArray> &frames, const QList<QByteArray> &extras)
+{
+    m_snapshot = frames;
+    m_snapshotExtras = extras;
+    m_snapshotVersion = m_version;
+    trim();
+}
+
+void SessionLog::resume(quint64 version, const QList<QByteArray> &tail)
+{
+    m_version = version;
+    m_tail = tail;
+    m_tailBase = m_version - quint64(tail.size());
+    m_tailBytes = 0;
+    for (auto& frame : m_tail)
+    {
+        m_tailBytes += frame.size();
+    }
+    m_snapshot.clear();
+    m_snapshotExtras.clear();
+    trim();
+}
+
+const QList<QByteArray>& SessionLog::snapshot() const
+{
+    return m_snapshot;
+}
+
+const QList<QByteArray>& SessionLog::snapshotExtras() const
+{
+    return m_snapshotExtras;
+}
+
+quint64 SessionLog::snapshotVersion() const
+{
+    return m_snapshotVersion;
+}
+
+const QList<QByteArray>& SessionLog::tail() const
+{
+    return m_tail;
+}
+
+bool SessionLog::tailSince(quint64 version, QList<QByteArray> &frames) const
+{
+    if (version < m_tailBase || version > m_version)
+    {
+        return false;
+    }
+    frames = m_tail.mid(int(version - m_tailBase));
+    return true;
+}
+
+quint64 SessionLog::version() const
+{
+    return m_version;
+}
+
+quint64 SessionLog::tailBase() const
+{
+    return m_tailBase;
+}
+
+void SessionLog::setLimits(int max_ops, int max_bytes)
+{
+    m_maxOps = max_ops;
+    m_maxBytes = max_bytes;
+    trim();
+}
+
+void SessionLog::setKeepHistory(bool keep)
+{
+    m_keepHistory = keep;
+}
+
+bool SessionLog::overLimits() const
+{
+    return m_tail.size() > m_maxOps || m_tailBytes > m_maxBytes;
+}
+
+void SessionLog::trim()
+{
+    while (!m_tail.isEmpty() && overLimits())
+    {
+        if (m_keepHistory && m_tailBase >= m_snapshotVersion)
+        {
+            return;
+        }
+        m_tailBytes -= m_tail.first().size();
+        m_tail.removeFirst();
+        ++m_tailBase;
+    }
+    if (!hasFreshSnapshot())
+    {
+        m_snapshot.clear();
+        m_snapshotExtras.clear();
+    }
+}
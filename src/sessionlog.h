@@ -0,0 +1,71 @@
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <QByteArray>
+#include <QList>
+
+// Host-side history used to bring peers up to date. The host numbers every op it
+// sequences; the tail holds the frames of the most recent ones, versions
+// tailBase() + 1 to version(). Peers that already have the document at some version
+// only need tailSince() that version.
+// Joiners start from a snapshot (a kInit frame and its kInitChunk frames) taken when the
+// log was at snapshotVersion(), the extras (earlier ops the snapshot does not reflect),
+// then the tail since snapshotVersion().
+// Once the tail outgrows its limits its oldest ops are dropped, and with them the snapshot,
+// unless the log keeps history: then only ops the snapshot covers are dropped and
+// needsSnapshot() asks the owner for a newer one.
+class SessionLog
+{
+public:
+    void append(const QByteArray& frame);
+
+    bool hasFreshSnapshot() const;
+
+    bool needsSnapshot() const;
+
+    // Snapshot of the document as of now, apart from the extras.
+    void setSnapshot(const QList<QByteArray>& frames, const QList<QByteArray>& extras = QList<QByteArray>());
+
+    // Continues the numbering of a previous host: tail are its ops up to version.
+    void resume(quint64 version, const QList<QByteArray>& tail);
+
+    const QList<QByteArray>& snapshot() const;
+
+    const QList<QByteArray>& snapshotExtras() const;
+
+    quint64 snapshotVersion() const;
+
+    const QList<QByteArray>& tail() const;
+
+    // The ops after version, if the tail still reaches back that far.
+    bool tailSince(quint64 version, QList<QByteArray>& frames) const;
+
+    quint64 version() const;
+
+    quint64 tailBase() const;
+
+    void setLimits(int max_ops, int max_bytes);
+
+    void setKeepHistory(bool keep);
+
+private:
+    bool overLimits() const;
+
+    void trim();
+
+    QList<QByteArray> m_snapshot;
+    QList<QByteArray> m_snapshotExtras;
+    quint64 m_snapshotVersion = 0;
+
+    QList<QByteArray> m_tail;
+    qint64 m_tailBytes = 0;
+
+    quint64 m_version = 0;
+    quint64 m_tailBase = 0;
+
+    int m_maxOps = 2000;
+    int m_maxBytes = 4 * 1024 * 1024;
+    bool m_keepHistory = false;
+};
+
+#endif // SESSIONLOG_H
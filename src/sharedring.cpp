@@ -0,0 +1,266 @@
+#include "sharedring.h"
+
+#include <QDebug>
+
+#include <new>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    const quint32 kMagic = 0x74657272;
+    // Records are [length][origin][piece of a frame], padded to kAlign so their header never
+    // wraps. Frames larger than a quarter of the ring go out in pieces; all but the last
+    // have kMorePieces set in their length.
+    const quint32 kRecordHeaderSize = 8;
+    const quint32 kMorePieces = 0x80000000;
+    const quint32 kAlign = 8;
+    const int kDataOffset = 64;
+    const long kWatchTimeoutNs = 100 * 1000 * 1000;
+
+    static_assert(sizeof(SharedRing::Header) <= kDataOffset, "ring header overlaps the data");
+    static_assert(sizeof(std::atomic<quint32>) == sizeof(quint32), "futex word must be a plain 32-bit int");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "ring positions must be lock-free to be shared between processes");
+
+    quint64 recordSize(int frame_size)
+    {
+        return (kRecordHeaderSize + quint64(frame_size) + kAlign - 1) / kAlign * kAlign;
+    }
+
+    long futex(std::atomic<quint32>* word, int op, quint32 value, const timespec* timeout)
+    {
+        return syscall(SYS_futex, reinterpret_cast<quint32*>(word), op, value, timeout, nullptr, 0);
+    }
+}
+
+SharedRingWriter::SharedRingWriter()
+{
+}
+
+SharedRingWriter::~SharedRingWriter()
+{
+    close();
+}
+
+bool SharedRingWriter::create(const QString &key, quint32 capacity)
+{
+    close();
+    capacity = capacity / kAlign * kAlign;
+    m_memory.setKey(key);
+    if (!m_memory.create(kDataOffset + capacity))
+    {
+        if (m_memory.error() != QSharedMemory::AlreadyExists)
+        {
+            qDebug() << __FUNCTION__ << m_memory.errorString();
+            return false;
+        }
+        // Left over from a host that died; detaching the last attachment removes it.
+        m_memory.attach();
+        m_memory.detach();
+        if (!m_memory.create(kDataOffset + capacity))
+        {
+            qDebug() << __FUNCTION__ << m_memory.errorString();
+            return false;
+        }
+    }
+    char* base = static_cast<char*>(m_memory.data());
+    m_header = new (base) SharedRing::Header;
+    m_header->magic = kMagic;
+    m_header->capacity = capacity;
+    m_header->reserved.store(0);
+    m_header->head.store(0);
+    m_header->sequence.store(0);
+    m_header->sleepers.store(0);
+    m_data = base + kDataOffset;
+    return true;
+}
+
+void SharedRingWriter::close()
+{
+    if (m_memory.isAttached())
+    {
+        m_memory.detach();
+    }
+    m_header = nullptr;
+    m_data = nullptr;
+}
+
+bool SharedRingWriter::isOpen() const
+{
+    return m_header != nullptr;
+}
+
+quint64 SharedRingWriter::position() const
+{
+    return m_header ? m_header->head.load(std::memory_order_relaxed) : 0;
+}
+
+bool SharedRingWriter::publish(const QByteArray &frame, quint32 origin)
+{
+    if (!m_header)
+    {
+        return false;
+    }
+    const int max_piece = m_header->capacity / 4 - kRecordHeaderSize;
+    int offset = 0;
+    do
+    {
+        const int length = std::min(max_piece, frame.size() - offset);
+        const bool more = offset + length < frame.size();
+        write(frame.constData() + offset, length, more, origin);
+        offset += length;
+    } while (offset < frame.size());
+    return true;
+}
+
+// Readers check reserved after copying a record, so it moves before the bytes it covers.
+void SharedRingWriter::write(const char *piece, quint32 length, bool more, quint32 origin)
+{
+    const quint32 capacity = m_header->capacity;
+    const quint64 size = recordSize(length);
+    const quint64 start = m_header->head.load(std::memory_order_relaxed);
+    m_header->reserved.store(start + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const quint32 offset = start % capacity;
+    const quint32 header[2] = {length | (more ? kMorePieces : 0), origin};
+    std::memcpy(m_data + offset, header, kRecordHeaderSize);
+    const quint32 at = (offset + kRecordHeaderSize) % capacity;
+    const quint32 first = std::min(length, capacity - at);
+    std::memcpy(m_data + at, piece, first);
+    std::memcpy(m_data, piece + first, length - first);
+
+    m_header->head.store(start + size, std::memory_order_release);
+    m_header->sequence.fetch_add(1, std::memory_order_release);
+    if (m_header->sleepers.load() > 0)
+    {
+        futex(&m_header->sequence, FUTEX_WAKE, INT_MAX, nullptr);
+    }
+}
+
+SharedRingReader::SharedRingReader(QObject *parent) :
+    BroadcastReader(parent)
+{
+}
+
+SharedRingReader::~SharedRingReader()
+{
+    if (m_watcher)
+    {
+        m_running.store(false);
+        m_watcher->wait();
+        delete m_watcher;
+    }
+}
+
+bool SharedRingReader::attach(const QString &key, quint64 position)
+{
+    m_memory.setKey(key);
+    if (!m_memory.attach())
+    {
+        qDebug() << __FUNCTION__ << m_memory.errorString();
+        return false;
+    }
+    char* base = static_cast<char*>(m_memory.data());
+    m_header = reinterpret_cast<SharedRing::Header*>(base);
+    if (m_memory.size() < kDataOffset || m_header->magic != kMagic || m_memory.size() < kDataOffset + int(m_header->capacity))
+    {
+        qDebug() << __FUNCTION__ << "not a ring" << key;
+        m_header = nullptr;
+        m_memory.detach();
+        return false;
+    }
+    m_data = base + kDataOffset;
+    m_cursor = position;
+    m_running.store(true);
+    m_watcher = QThread::create([this]() { watch(); });
+    m_watcher->start();
+    return true;
+}
+
+BroadcastReader::Result SharedRingReader::next(QByteArray &frame, quint32 &origin)
+{
+    if (!m_header)
+    {
+        return kOverrun;
+    }
+    const quint32 capacity = m_header->capacity;
+    for (;;)
+    {
+        quint64 head = m_header->head.load(std::memory_order_acquire);
+        if (head == m_cursor)
+        {
+            // Re-checked after clearing the flag, or a publish in between would go unannounced.
+            m_signalled.store(false);
+            head = m_header->head.load();
+            if (head == m_cursor)
+            {
+                return kEmpty;
+            }
+        }
+        if (head - m_cursor > capacity)
+        {
+            return kOverrun;
+        }
+
+        const quint32 offset = m_cursor % capacity;
+        quint32 header[2];
+        std::memcpy(header, m_data + offset, kRecordHeaderSize);
+        const quint32 length = header[0] & ~kMorePieces;
+        if (recordSize(length) > head - m_cursor)
+        {
+            return kOverrun;
+        }
+        const quint32 at = (offset + kRecordHeaderSize) % capacity;
+        const quint32 first = std::min(length, capacity - at);
+        const int known = m_partial.size();
+        m_partial.resize(known + length);
+        std::memcpy(m_partial.data() + known, m_data + at, first);
+        std::memcpy(m_partial.data() + known + first, m_data, length - first);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_header->reserved.load(std::memory_order_relaxed) > m_cursor + capacity)
+        {
+            return kOverrun;
+        }
+        m_cursor += recordSize(length);
+        if (!(header[0] & kMorePieces))
+        {
+            origin = header[1];
+            frame.swap(m_partial);
+            m_partial.clear();
+            return kFrame;
+        }
+    }
+}
+
+// Runs on its own thread: sleeps until something is published, then tells the owner once.
+void SharedRingReader::watch()
+{
+    quint64 seen = m_cursor;
+    const timespec timeout = {0, kWatchTimeoutNs};
+    while (m_running.load())
+    {
+        const quint32 sequence = m_header->sequence.load(std::memory_order_acquire);
+        const quint64 head = m_header->head.load(std::memory_order_acquire);
+        if (head != seen)
+        {
+            seen = head;
+            if (!m_signalled.exchange(true))
+            {
+                emit readyRead();
+            }
+            continue;
+        }
+        m_header->sleepers.fetch_add(1);
+        futex(&m_header->sequence, FUTEX_WAIT, sequence, &timeout);
+        m_header->sleepers.fetch_sub(1);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SHAREDRING_H
+#define SHAREDRING_H
+
+#include <QSharedMemory>
+#include <QThread>
+
+#include <atomic>
+
+#include "transport.h"
+
+// A ring of frames in shared memory with one writer and any number of readers. The writer
+// never waits for readers: one that gets lapped finds out on its next read. Readers sleep
+// on a futex in the segment, so a publish costs one wake-up however many readers there
+// are, and none while nobody sleeps.
+namespace SharedRing
+{
+    const quint32 kDefaultCapacity = 8 << 20;
+
+    struct Header
+    {
+        quint32 magic;
+        quint32 capacity;
+        // Logical end of the record being written, and of the last complete one.
+        std::atomic<quint64> reserved;
+        std::atomic<quint64> head;
+        // Futex word, bumped by every publish.
+        std::atomic<quint32> sequence;
+        std::atomic<quint32> sleepers;
+    };
+}
+
+class SharedRingWriter
+{
+public:
+    SharedRingWriter();
+
+    ~SharedRingWriter();
+
+    bool create(const QString& key, quint32 capacity = SharedRing::kDefaultCapacity);
+
+    void close();
+
+    bool isOpen() const;
+
+    quint64 position() const;
+
+    bool publish(const QByteArray& frame, quint32 origin);
+
+private:
+    void write(const char* piece, quint32 length, bool more, quint32 origin);
+
+    QSharedMemory m_memory;
+    SharedRing::Header* m_header = nullptr;
+    char* m_data = nullptr;
+};
+
+class SharedRingReader : public BroadcastReader
+{
+    Q_OBJECT
+public:
+    explicit SharedRingReader(QObject* parent = nullptr);
+
+    ~SharedRingReader();
+
+    bool attach(const QString& key, quint64 position);
+
+    Result next(QByteArray& frame, quint32& origin) override;
+
+private:
+    void watch();
+
+    QSharedMemory m_memory;
+    SharedRing::Header* m_header = nullptr;
+    const char* m_data = nullptr;
+    quint64 m_cursor = 0;
+    // The pieces of a frame read so far.
+    QByteArray m_partial;
+
+    QThread* m_watcher = nullptr;
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_signalled{false};
+};
+
+#endif // SHAREDRING_H
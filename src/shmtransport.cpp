@@ -0,0 +1,60 @@
+#include "shmtransport.h"
+
+#include <QCoreApplication>
+
+ShmTransport::ShmTransport(QObject *parent) :
+    LocalTransport(parent)
+{
+}
+
+bool ShmTransport::canBroadcast() const
+{
+    return true;
+}
+
+// Keyed by process too, so a new host never has to share a name with a ring the old
+// host's readers still have attached.
+QString ShmTransport::openBroadcast(const QString &name)
+{
+    const QString key = QString("%1.ring.%2").arg(name).arg(QCoreApplication::applicationPid());
+    closeBroadcast(key);
+    QSharedPointer<SharedRingWriter> ring(new SharedRingWriter);
+    if (!ring->create(key))
+    {
+        return QString();
+    }
+    m_rings.insert(key, ring);
+    return key;
+}
+
+void ShmTransport::closeBroadcast(const QString &key)
+{
+    QSharedPointer<SharedRingWriter> ring = m_rings.take(key);
+    if (ring)
+    {
+        ring->close();
+    }
+}
+
+quint64 ShmTransport::broadcastPosition(const QString &key) const
+{
+    QSharedPointer<SharedRingWriter> ring = m_rings.value(key);
+    return ring ? ring->position() : 0;
+}
+
+bool ShmTransport::publish(const QString &key, const QByteArray &frame, quint32 origin)
+{
+    auto ring = m_rings.constFind(key);
+    return ring != m_rings.constEnd() && ring.value()->publish(frame, origin);
+}
+
+BroadcastReader* ShmTransport::attachBroadcast(const QString &key, quint64 position, QObject *parent)
+{
+    SharedRingReader* reader = new SharedRingReader(parent);
+    if (!reader->attach(key, position))
+    {
+        delete reader;
+        return nullptr;
+    }
+    return reader;
+}
@@ -0,0 +1,35 @@
+#ifndef SHMTRANSPORT_H
+#define SHMTRANSPORT_H
+
+#include <QHash>
+#include <QSharedPointer>
+
+#include "localtransport.h"
+#include "sharedring.h"
+
+// Local sockets for hellos, acks, snapshots and ops on their way to the host, plus a
+// shared-memory ring the host publishes relayed ops to once for every peer on the machine.
+class ShmTransport : public LocalTransport
+{
+    Q_OBJECT
+public:
+    explicit ShmTransport(QObject* parent = nullptr);
+
+    bool canBroadcast() const override;
+
+    QString openBroadcast(const QString& name) override;
+
+    void closeBroadcast(const QString& key) override;
+
+    quint64 broadcastPosition(const QString& key) const override;
+
+    bool publish(const QString& key, const QByteArray& frame, quint32 origin) override;
+
+    BroadcastReader* attachBroadcast(const QString& key, quint64 position, QObject* parent) override;
+
+private:
+    // By key; a hub opens one for each session that has readers on this machine.
+    QHash<QString, QSharedPointer<SharedRingWriter>> m_rings;
+};
+
+#endif // SHMTRANSPORT_H
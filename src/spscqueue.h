@@ -0,0 +1,64 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+// Unbounded single-producer single-consumer queue. push() may only be called from
+// one thread and pop() from one (other) thread; neither takes a lock.
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue() :
+        m_head(new Node),
+        m_tail(m_head)
+    {}
+
+    ~SpscQueue()
+    {
+        while (m_head)
+        {
+            Node* next = m_head->next.load(std::memory_order_relaxed);
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    void push(T value)
+    {
+        Node* node = new Node;
+        node->value = std::move(value);
+        m_tail->next.store(node, std::memory_order_release);
+        m_tail = node;
+    }
+
+    bool pop(T& value)
+    {
+        Node* next = m_head->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            return false;
+        }
+        value = std::move(next->value);
+        delete m_head;
+        m_head = next;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    // m_head is the consumer's (already consumed) node, m_tail the producer's last one.
+    Node* m_head;
+    Node* m_tail;
+};
+
+#endif // SPSCQUEUE_H
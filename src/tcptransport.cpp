@@ -0,0 +1,199 @@
+#include "tcptransport.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+namespace
+{
+    // Per endpoint, so hubs on different ports keep their peer-hosted sessions apart.
+    QString sessionFile(quint16 base, const QString& name, const char* suffix)
+    {
+        return QDir(QDir::tempPath()).filePath(QString("textedit-tcp-%1-%2.%3").arg(base).arg(name).arg(suffix));
+    }
+
+    // The hub has the endpoint's port. Any other name has the port its host published on
+    // this machine, or none.
+    quint16 portFor(quint16 base, const QString& name)
+    {
+        if (name == Transport::hubName())
+        {
+            return base;
+        }
+        QFile file(sessionFile(base, name, "port"));
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            return 0;
+        }
+        return file.readAll().trimmed().toUShort();
+    }
+}
+
+TcpConnection::TcpConnection(QTcpSocket *socket, const QString &host, quint16 port, QObject *parent) :
+    Connection(parent),
+    m_socket(socket ? socket : new QTcpSocket),
+    m_host(host),
+    m_port(port)
+{
+    m_socket->setParent(this);
+    connect(m_socket, &QTcpSocket::connected, this, &TcpConnection::setLowDelay);
+    connect(m_socket, &QTcpSocket::connected, this, &Connection::connected);
+    connect(m_socket, &QTcpSocket::disconnected, this, &Connection::disconnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &Connection::readyRead);
+    connect(m_socket, &QTcpSocket::errorOccurred, this, &Connection::errorOccurred);
+    if (m_socket->state() == QAbstractSocket::ConnectedState)
+    {
+        setLowDelay();
+    }
+}
+
+QIODevice* TcpConnection::device()
+{
+    return m_socket;
+}
+
+void TcpConnection::connectToServer(const QString &name)
+{
+    const quint16 port = portFor(m_port, name);
+    if (port == 0)
+    {
+        // Nobody hosts the name; fails the way a closed port would, without blocking.
+        QMetaObject::invokeMethod(this, "errorOccurred", Qt::QueuedConnection);
+        return;
+    }
+    m_socket->connectToHost(m_host, port);
+}
+
+bool TcpConnection::waitForConnected(int msecs)
+{
+    return m_socket->waitForConnected(msecs);
+}
+
+bool TcpConnection::isConnected() const
+{
+    return m_socket->state() == QAbstractSocket::ConnectedState;
+}
+
+void TcpConnection::disconnectFromServer()
+{
+    m_socket->disconnectFromHost();
+}
+
+void TcpConnection::abort()
+{
+    m_socket->abort();
+}
+
+bool TcpConnection::flush()
+{
+    return m_socket->flush();
+}
+
+QString TcpConnection::errorString() const
+{
+    return m_socket->errorString();
+}
+
+// Ops are small and latency bound; the outbound queue already coalesces what it can.
+void TcpConnection::setLowDelay()
+{
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+}
+
+TcpTransport::TcpTransport(const QString &endpoint, QObject *parent) :
+    Transport(parent),
+    m_server(this),
+    m_host(endpoint.section(':', 0, 0)),
+    m_port(kDefaultPort)
+{
+    if (m_host.isEmpty())
+    {
+        m_host = "127.0.0.1";
+    }
+    bool ok = false;
+    const quint16 port = endpoint.section(':', 1, 1).toUShort(&ok);
+    if (ok)
+    {
+        m_port = port;
+    }
+    connect(&m_server, &QTcpServer::newConnection, this, &Transport::newConnection);
+}
+
+TcpTransport::~TcpTransport()
+{
+    close();
+}
+
+// Peers promoting at once race for the lock, not the port, so only one of them hosts.
+bool TcpTransport::listen(const QString &name)
+{
+    m_nameTaken = false;
+    if (name == hubName())
+    {
+        return m_server.listen(QHostAddress(m_host), m_port);
+    }
+    QScopedPointer<QLockFile> lock(new QLockFile(sessionFile(m_port, name, "lock")));
+    // A lock is stale only once its owner has died, however long it has been held.
+    lock->setStaleLockTime(0);
+    if (!lock->tryLock(0))
+    {
+        m_nameTaken = true;
+        return false;
+    }
+    if (!m_server.listen(QHostAddress(m_host), 0))
+    {
+        return false;
+    }
+    QSaveFile file(sessionFile(m_port, name, "port"));
+    if (!file.open(QIODevice::WriteOnly) || file.write(QByteArray::number(m_server.serverPort())) < 0 || !file.commit())
+    {
+        m_server.close();
+        return false;
+    }
+    m_lock.swap(lock);
+    m_portFile = file.fileName();
+    return true;
+}
+
+void TcpTransport::close()
+{
+    m_server.close();
+    if (!m_portFile.isEmpty())
+    {
+        QFile::remove(m_portFile);
+        m_portFile.clear();
+    }
+    m_lock.reset();
+}
+
+bool TcpTransport::hasPendingConnections() const
+{
+    return m_server.hasPendingConnections();
+}
+
+Connection* TcpTransport::nextPendingConnection()
+{
+    QTcpSocket* socket = m_server.nextPendingConnection();
+    return socket ? new TcpConnection(socket, m_host, m_port) : nullptr;
+}
+
+Connection* TcpTransport::createConnection(QObject *parent)
+{
+    return new TcpConnection(nullptr, m_host, m_port, parent);
+}
+
+QString TcpTransport::errorString() const
+{
+    return m_nameTaken ? QString("the session is hosted by another peer") : m_server.errorString();
+}
+
+bool TcpTransport::addressInUse() const
+{
+    return m_nameTaken || m_server.serverError() == QAbstractSocket::AddressInUseError;
+}
+
+// tryLock() takes over the lock of a host that died, and listen() rewrites its port file.
+void TcpTransport::removeStale(const QString &name)
+{
+    Q_UNUSED(name);
+}
@@ -0,0 +1,87 @@
+#ifndef TCPTRANSPORT_H
+#define TCPTRANSPORT_H
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QLockFile>
+#include <QScopedPointer>
+
+#include "transport.h"
+
+class TcpConnection : public Connection
+{
+    Q_OBJECT
+public:
+    // Takes over socket, or creates one if it is null; connects to host at port for the
+    // hub and at the port published for any other name.
+    TcpConnection(QTcpSocket* socket, const QString& host, quint16 port, QObject* parent = nullptr);
+
+    QIODevice* device() override;
+
+    void connectToServer(const QString& name) override;
+
+    bool waitForConnected(int msecs) override;
+
+    bool isConnected() const override;
+
+    void disconnectFromServer() override;
+
+    void abort() override;
+
+    bool flush() override;
+
+    QString errorString() const override;
+
+private:
+    void setLowDelay();
+
+    QTcpSocket* m_socket;
+    QString m_host;
+    quint16 m_port;
+};
+
+// TCP with Nagle off, so a session can span machines. A hub listens on the endpoint's
+// port and routes by the session named in the hello. A session hosted by a peer listens
+// on a port the system picks and publishes it in a file, next to a lock that makes the
+// name that peer's; only peers on the host's machine find it, so failover only works
+// between them. A stale file may name a port someone else has since been given, so a
+// host still checks the session in every hello.
+class TcpTransport : public Transport
+{
+    Q_OBJECT
+public:
+    // endpoint is host:port, the hub's port; the host is listened on as well as connected to.
+    explicit TcpTransport(const QString& endpoint, QObject* parent = nullptr);
+
+    ~TcpTransport();
+
+    static const quint16 kDefaultPort = 7800;
+
+    bool listen(const QString& name) override;
+
+    void close() override;
+
+    bool hasPendingConnections() const override;
+
+    Connection* nextPendingConnection() override;
+
+    Connection* createConnection(QObject* parent) override;
+
+    QString errorString() const override;
+
+    bool addressInUse() const override;
+
+    void removeStale(const QString& name) override;
+
+private:
+    QTcpServer m_server;
+    QString m_host;
+    quint16 m_port;
+    // Held while this transport hosts a session under its own name, and where its port is.
+    QScopedPointer<QLockFile> m_lock;
+    QString m_portFile;
+    bool m_nameTaken = false;
+};
+
+#endif // TCPTRANSPORT_H
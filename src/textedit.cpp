@@ -60,7 +60,11 @@
 #include <QFontDatabase>
 #include <QMenu>
 #include <QMenuBar>
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+#include <QStringDecoder>
+#else
 #include <QTextCodec>
+#endif
 #include <QTextEdit>
 #include <QStatusBar>
 #include <QToolBar>
@@ -86,6 +90,7 @@
 #endif
 
 #include "textedit.h"
+#include "tracing.h"
 
 #ifdef Q_OS_MAC
 const QString rsrcPath = ":/images/mac";
@@ -93,6 +98,24 @@ const QString rsrcPath = ":/images/mac";
 const QString rsrcPath = ":/images/win";
 #endif
 
+namespace
+{
+    // Repaints show up in the trace with the remote ops applied since the previous one.
+    class TracedTextEdit : public QTextEdit
+    {
+    public:
+        using QTextEdit::QTextEdit;
+
+    protected:
+        void paintEvent(QPaintEvent *event) override
+        {
+            TraceSpan span("repaint");
+            span.takeApplied();
+            QTextEdit::paintEvent(event);
+        }
+    };
+}
+
 TextEdit::TextEdit(QWidget *parent)
     : QMainWindow(parent)
 {
@@ -101,7 +124,7 @@ TextEdit::TextEdit(QWidget *parent)
 #endif
     setWindowTitle(QCoreApplication::applicationName());
 
-    textEdit = new QTextEdit(this);
+    textEdit = new TracedTextEdit(this);
     connect(textEdit, &QTextEdit::currentCharFormatChanged,
             this, &TextEdit::currentCharFormatChanged);
     connect(textEdit, &QTextEdit::cursorPositionChanged,
@@ -421,8 +444,13 @@ bool TextEdit::load(const QString &f)
         return false;
 
     QByteArray data = file.readAll();
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    auto encoding = QStringDecoder::encodingForHtml(data);
+    QString str = QStringDecoder(encoding ? *encoding : QStringDecoder::Utf8)(data);
+#else
     QTextCodec *codec = Qt::codecForHtml(data);
     QString str = codec->toUnicode(data);
+#endif
     if (Qt::mightBeRichText(str)) {
         QUrl baseUrl = (f.front() == QLatin1Char(':') ? QUrl(f) : QUrl::fromLocalFile(f)).adjusted(QUrl::RemoveFilename);
         textEdit->document()->setBaseUrl(baseUrl);
@@ -451,16 +479,6 @@ QTextDocument* TextEdit::document()
     return textEdit->document();
 }
 
-void TextEdit::externalSetTextStyleByIndex(int styleIndex)
-{
-    customTextStyle(styleIndex);
-}
-
-void TextEdit::externalMergeTextStyleByIndex(int styleIndex)
-{
-    customTextStyle(styleIndex, true);
-}
-
 int TextEdit::getStyle()
 {
     return comboStyle->currentIndex();
@@ -674,7 +692,9 @@ void TextEdit::textStyle(int styleIndex)
 void TextEdit::customTextStyle(int styleIndex, bool merge)
 {
     QTextCursor cursor = textEdit->textCursor();
-    emit styleChanged(styleIndex, cursor.position());
+    const int firstBlock = document()->findBlock(cursor.selectionStart()).position();
+    const int lastBlock = document()->findBlock(cursor.selectionEnd()).position();
+    QTextCharFormat headingFmt;
     QTextListFormat::Style style = QTextListFormat::ListStyleUndefined;
     QTextBlockFormat::MarkerType marker = QTextBlockFormat::MarkerType::NoMarker;
 
@@ -721,6 +741,8 @@ void TextEdit::customTextStyle(int styleIndex, bool merge)
         break;
     }
 
+    // Peers get the outcome through styleChanged/charFormatChanged, not contentsChange.
+    QSignalBlocker blocker(this);
     cursor.beginEditBlock();
 
     QTextBlockFormat blockFmt = cursor.blockFormat();
@@ -740,6 +762,7 @@ void TextEdit::customTextStyle(int styleIndex, bool merge)
             cursor.select(QTextCursor::LineUnderCursor);
             cursor.mergeCharFormat(fmt);
             textEdit->mergeCurrentCharFormat(fmt);
+            headingFmt = fmt;
         }
     } else {
         blockFmt.setMarker(marker);
@@ -769,6 +792,16 @@ void TextEdit::customTextStyle(int styleIndex, bool merge)
     }
 
     cursor.endEditBlock();
+    blocker.unblock();
+
+    emit styleChanged(firstBlock, lastBlock - firstBlock);
+    if (!headingFmt.properties().isEmpty()) {
+        if (cursor.hasSelection())
+            emit charFormatChanged(cursor.selectionStart(), cursor.selectionEnd() - cursor.selectionStart(), headingFmt);
+        const QTextCursor selection = textEdit->textCursor();
+        if (selection.hasSelection())
+            emit charFormatChanged(selection.selectionStart(), selection.selectionEnd() - selection.selectionStart(), headingFmt);
+    }
 }
 
 void TextEdit::textColor()
@@ -912,9 +945,15 @@ void TextEdit::mergeFormatOnWordOrSelection(const QTextCharFormat &format)
     QTextCursor cursor = textEdit->textCursor();
     if (!cursor.hasSelection())
         cursor.select(QTextCursor::WordUnderCursor);
-    cursor.mergeCharFormat(format);
-    //textEdit->setTextCursor(cursor);
-    textEdit->mergeCurrentCharFormat(format);
+    {
+        // The merge is reported once through charFormatChanged instead of contentsChange.
+        const QSignalBlocker blocker(this);
+        cursor.mergeCharFormat(format);
+        //textEdit->setTextCursor(cursor);
+        textEdit->mergeCurrentCharFormat(format);
+    }
+    if (cursor.hasSelection())
+        emit charFormatChanged(cursor.selectionStart(), cursor.selectionEnd() - cursor.selectionStart(), format);
 }
 
 void TextEdit::fontChanged(const QFont &f)
@@ -80,10 +80,6 @@ public:
 
     QTextDocument* document();
 
-    void externalSetTextStyleByIndex(int styleIndex);
-
-    void externalMergeTextStyleByIndex(int styleIndex);
-
     int getStyle();
 
 public slots:
@@ -91,7 +87,8 @@ public slots:
 
 signals:
     void contentsChange(int position, int charRemoved, int charAdded);
-    void styleChanged(int styleIndex, int position);
+    void styleChanged(int position, int length);
+    void charFormatChanged(int position, int length, const QTextCharFormat &format);
 
 protected:
     void closeEvent(QCloseEvent *e) override;
@@ -0,0 +1,194 @@
+#include "tracing.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+#include <QDebug>
+
+#include <chrono>
+
+std::atomic<bool> Tracing::g_enabled{false};
+
+namespace
+{
+    // Events are buffered and appended in one write, which O_APPEND keeps whole when
+    // several processes share the file.
+    const int kFlushBytes = 64 * 1024;
+    const qint64 kFlushIntervalUs = 500 * 1000;
+
+    QMutex g_mutex;
+    QFile g_file;
+    QByteArray g_buffer;
+    qint64 g_lastFlushUs = 0;
+    qint64 g_pid = 0;
+    std::atomic<quint32> g_nextOp{0};
+    std::atomic<int> g_nextThread{0};
+
+    thread_local int t_thread = 0;
+    thread_local QVector<quint64> t_applied;
+
+    QByteArray quoted(const QString& text)
+    {
+        QByteArray escaped = text.toUtf8();
+        escaped.replace('\\', "\\\\").replace('"', "\\\"");
+        return '"' + escaped + '"';
+    }
+
+    void append(const QByteArray& event)
+    {
+        g_buffer += event;
+        g_buffer += ",\n";
+    }
+
+    void flushLocked()
+    {
+        if (!g_buffer.isEmpty() && g_file.isOpen())
+        {
+            g_file.write(g_buffer);
+        }
+        g_buffer.clear();
+    }
+
+    // Perfetto names the track of a thread after its first event.
+    int threadId()
+    {
+        if (t_thread == 0)
+        {
+            t_thread = ++g_nextThread;
+            const QString name = QThread::currentThread()->objectName();
+            QMutexLocker locker(&g_mutex);
+            append(QByteArray("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":") + QByteArray::number(g_pid)
+                   + ",\"tid\":" + QByteArray::number(t_thread)
+                   + ",\"args\":{\"name\":" + quoted(name.isEmpty() ? QString("thread %1").arg(t_thread) : name) + "}}");
+        }
+        return t_thread;
+    }
+}
+
+bool Tracing::enable(const QString &path, const QString &process_name)
+{
+    QMutexLocker locker(&g_mutex);
+    g_file.setFileName(path);
+    if (!g_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered))
+    {
+        qDebug() << __FUNCTION__ << path << g_file.errorString();
+        return false;
+    }
+    g_pid = QCoreApplication::applicationPid();
+    if (g_file.size() == 0)
+    {
+        g_file.write("[\n");
+    }
+    append(QByteArray("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":") + QByteArray::number(g_pid)
+           + ",\"args\":{\"name\":" + quoted(QString("%1 %2").arg(process_name).arg(g_pid)) + "}}");
+    g_lastFlushUs = nowUs();
+    g_enabled.store(true);
+    qAddPostRoutine(Tracing::stop);
+    return true;
+}
+
+void Tracing::stop()
+{
+    g_enabled.store(false);
+    QMutexLocker locker(&g_mutex);
+    flushLocked();
+    g_file.close();
+}
+
+// The pid keeps ids apart between processes, the counter within one.
+quint64 Tracing::nextOp()
+{
+    return (quint64(g_pid) << 32) | ++g_nextOp;
+}
+
+void Tracing::applied(quint64 op)
+{
+    if (op != 0)
+    {
+        t_applied.push_back(op);
+    }
+}
+
+// Spans of one op are bound into a flow, which Perfetto draws as arrows across threads and processes.
+void Tracing::complete(const char *name, qint64 start_us, qint64 end_us, quint64 op, const QByteArray &detail)
+{
+    const int tid = threadId();
+    QByteArray event = QByteArray("{\"ph\":\"X\",\"cat\":\"edit\",\"name\":\"") + name + "\",\"pid\":" + QByteArray::number(g_pid)
+                       + ",\"tid\":" + QByteArray::number(tid) + ",\"ts\":" + QByteArray::number(start_us)
+                       + ",\"dur\":" + QByteArray::number(end_us - start_us);
+    if (op != 0)
+    {
+        const QByteArray id = "\"0x" + QByteArray::number(op, 16) + '"';
+        event += ",\"bind_id\":" + id + ",\"flow_in\":true,\"flow_out\":true";
+    }
+    event += ",\"args\":{";
+    if (op != 0)
+    {
+        event += "\"op\":\"" + QByteArray::number(op, 16) + '"';
+    }
+    if (!detail.isEmpty())
+    {
+        event += QByteArray(op != 0 ? "," : "") + "\"detail\":" + quoted(QString::fromUtf8(detail));
+    }
+    event += "}}";
+
+    QMutexLocker locker(&g_mutex);
+    append(event);
+    if (g_buffer.size() >= kFlushBytes || end_us - g_lastFlushUs >= kFlushIntervalUs)
+    {
+        flushLocked();
+        g_lastFlushUs = end_us;
+    }
+}
+
+qint64 Tracing::nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceSpan::TraceSpan(const char *name, quint64 op) :
+    m_name(name),
+    m_op(op),
+    m_startUs(Tracing::enabled() ? Tracing::nowUs() : -1)
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (m_startUs >= 0 && Tracing::enabled())
+    {
+        Tracing::complete(m_name, m_startUs, Tracing::nowUs(), m_op, m_detail);
+    }
+}
+
+void TraceSpan::setOp(quint64 op)
+{
+    m_op = op;
+}
+
+void TraceSpan::setDetail(const QByteArray &detail)
+{
+    if (m_startUs >= 0)
+    {
+        m_detail = detail;
+    }
+}
+
+void TraceSpan::takeApplied()
+{
+    if (m_startUs < 0 || t_applied.isEmpty())
+    {
+        return;
+    }
+    QByteArray ops;
+    for (auto op : t_applied)
+    {
+        ops += (ops.isEmpty() ? "" : " ") + QByteArray::number(op, 16);
+    }
+    m_op = t_applied.last();
+    m_detail = ops;
+    t_applied.clear();
+}
@@ -0,0 +1,69 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <atomic>
+
+// Opt-in timeline of how edits travel, as Chrome trace events (chrome://tracing, Perfetto).
+// Every process appends to the same file, with timestamps from the system-wide monotonic
+// clock, so the spans of one op on its sender, the host and every receiver line up; an op
+// keeps the id its sender gave it (Message::trace) all the way.
+// Off unless enable() is called; a span then costs one atomic load.
+namespace Tracing
+{
+    // Appends to path from now on; false if it cannot be opened.
+    bool enable(const QString& path, const QString& process_name);
+
+    // Writes out what is buffered; called at exit.
+    void stop();
+
+    inline bool enabled();
+
+    // A new op id, unique across the processes on this machine.
+    quint64 nextOp();
+
+    // An op applied on this thread, for the next TraceSpan::takeApplied() on it.
+    void applied(quint64 op);
+
+    void complete(const char* name, qint64 start_us, qint64 end_us, quint64 op, const QByteArray& detail);
+
+    qint64 nowUs();
+
+    extern std::atomic<bool> g_enabled;
+}
+
+inline bool Tracing::enabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+// Records one complete event from construction to destruction while tracing is on.
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name, quint64 op = 0);
+
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // For spans that learn their op along the way, like decoding.
+    void setOp(quint64 op);
+
+    void setDetail(const QByteArray& detail);
+
+    // For repaints: lists the ops applied on this thread since the last such span and
+    // binds it to the newest of them.
+    void takeApplied();
+
+private:
+    const char* m_name;
+    quint64 m_op;
+    qint64 m_startUs;
+    QByteArray m_detail;
+};
+
+#endif // TRACING_H
@@ -0,0 +1,26 @@
+#include "transport.h"
+#include "localtransport.h"
+#include "shmtransport.h"
+#include "tcptransport.h"
+
+Transport* Transport::create(const QString &kind)
+{
+    if (kind == "local")
+    {
+        return new LocalTransport;
+    }
+    if (kind == "shm")
+    {
+        return new ShmTransport;
+    }
+    if (kind == "tcp" || kind.startsWith("tcp:"))
+    {
+        return new TcpTransport(kind.mid(4));
+    }
+    return nullptr;
+}
+
+QString Transport::hubName()
+{
+    return "textedit-hub";
+}
@@ -0,0 +1,119 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QString>
+
+// One end of a peer connection. Frames are read from and written to device(); the rest
+// is the lifecycle, which differs between socket types.
+class Connection : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Connection(QObject* parent = nullptr) : QObject(parent) {}
+
+    virtual QIODevice* device() = 0;
+
+    virtual void connectToServer(const QString& name) = 0;
+
+    virtual bool waitForConnected(int msecs) = 0;
+
+    virtual bool isConnected() const = 0;
+
+    virtual void disconnectFromServer() = 0;
+
+    virtual void abort() = 0;
+
+    virtual bool flush() = 0;
+
+    virtual QString errorString() const = 0;
+
+signals:
+    void connected();
+
+    void disconnected();
+
+    void readyRead();
+
+    void errorOccurred();
+};
+
+// Frames the host published to a broadcast channel, read on the peer's side.
+class BroadcastReader : public QObject
+{
+    Q_OBJECT
+public:
+    enum Result
+    {
+        kFrame,
+        kEmpty,
+        kOverrun
+    };
+
+    explicit BroadcastReader(QObject* parent = nullptr) : QObject(parent) {}
+
+    // Copies out the next frame and the id of the peer it came from (0 for the host).
+    // kOverrun once the writer has lapped this reader; nothing more can be read then.
+    virtual Result next(QByteArray& frame, quint32& origin) = 0;
+
+signals:
+    // Emitted from any thread once after next() has returned kEmpty and frames arrived.
+    void readyRead();
+};
+
+// How peers of a session reach each other: a listening side for the host and outgoing
+// connections for everyone else. A transport may also offer a broadcast channel that
+// hands one copy of a frame to every peer on the machine; peers that read it get no
+// socket copy of what was published.
+class Transport : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Transport(QObject* parent = nullptr) : QObject(parent) {}
+
+    // "local", "shm" or "tcp[:host[:port]]"; nullptr for anything else.
+    static Transport* create(const QString& kind);
+
+    // The well-known name a multi-session hub listens on.
+    static QString hubName();
+
+    virtual bool listen(const QString& name) = 0;
+
+    virtual void close() = 0;
+
+    virtual bool hasPendingConnections() const = 0;
+
+    virtual Connection* nextPendingConnection() = 0;
+
+    virtual Connection* createConnection(QObject* parent) = 0;
+
+    virtual QString errorString() const = 0;
+
+    // True if listen() failed because something else has the name.
+    virtual bool addressInUse() const = 0;
+
+    // Clears what a host that went away left behind under name.
+    virtual void removeStale(const QString& name) = 0;
+
+    virtual bool canBroadcast() const { return false; }
+
+    // Host side: opens the channel for session name and returns the key peers attach by,
+    // which the calls below take. A hub's transport carries one channel per session.
+    virtual QString openBroadcast(const QString& name) { Q_UNUSED(name); return QString(); }
+
+    virtual void closeBroadcast(const QString& key) { Q_UNUSED(key); }
+
+    // Where the next published frame will go; a peer told this reads from there on.
+    virtual quint64 broadcastPosition(const QString& key) const { Q_UNUSED(key); return 0; }
+
+    // False if the frame did not go out; it has to be sent over the connections then.
+    virtual bool publish(const QString& key, const QByteArray& frame, quint32 origin) { Q_UNUSED(key); Q_UNUSED(frame); Q_UNUSED(origin); return false; }
+
+    virtual BroadcastReader* attachBroadcast(const QString& key, quint64 position, QObject* parent) { Q_UNUSED(key); Q_UNUSED(position); Q_UNUSED(parent); return nullptr; }
+
+signals:
+    void newConnection();
+};
+
+#endif // TRANSPORT_H
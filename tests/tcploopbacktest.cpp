@@ -0,0 +1,116 @@
+#include "bench.h"
+#include "benchclient.h"
+#include "hub.h"
+#include "networkworker.h"
+
+#include <QCoreApplication>
+#include <QList>
+#include <QScopedPointer>
+#include <QTcpServer>
+
+#include <cstdio>
+
+// Sessions over TCP on loopback, through a hub and hosted by peers under their own names.
+// Prints one line per check and exits non-zero if any failed.
+namespace
+{
+    int g_failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        std::fprintf(stderr, "%s: %s\n", condition ? "PASS" : "FAIL", what);
+        g_failures += condition ? 0 : 1;
+    }
+
+    // A port nothing listens on right now, so runs do not trip over each other.
+    quint16 freePort()
+    {
+        QTcpServer server;
+        server.listen(QHostAddress::LocalHost, 0);
+        return server.serverPort();
+    }
+
+    bool allJoined(const QList<BenchClient*>& clients, int timeout_ms)
+    {
+        return Bench::waitUntil([&]() {
+            for (auto client : clients)
+            {
+                if (!client->joined())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }, timeout_ms);
+    }
+
+    // Two sessions behind the hub's port; an op reaches the other peer of its own session only.
+    void hubRoutesBySession(const QString& transport)
+    {
+        QScopedPointer<Transport> client_transport(Transport::create(transport));
+        Hub hub(Transport::hubName(), "json", transport, 0);
+        check(hub.start(), "the hub listens on the endpoint's port");
+
+        BenchClient a1(client_transport.data(), Transport::hubName(), "a");
+        BenchClient a2(client_transport.data(), Transport::hubName(), "a");
+        BenchClient b1(client_transport.data(), Transport::hubName(), "b");
+        QList<quint64> a2_received;
+        QList<quint64> b1_received;
+        QObject::connect(&a2, &BenchClient::received, [&](quint64 id) { a2_received.push_back(id); });
+        QObject::connect(&b1, &BenchClient::received, [&](quint64 id) { b1_received.push_back(id); });
+        a1.connectToServer();
+        a2.connectToServer();
+        b1.connectToServer();
+        check(allJoined(QList<BenchClient*>() << &a1 << &a2 << &b1, 5000), "peers of two sessions join through the hub");
+        check(hub.sessionCount() == 2, "the hub keeps one session per name");
+
+        a1.sendOp(1);
+        Bench::waitUntil([&]() { return !a2_received.isEmpty(); }, 5000);
+        Bench::waitUntil([]() { return false; }, 100);
+        check(a2_received == QList<quint64>() << 1, "an op reaches the other peer of its session");
+        check(b1_received.isEmpty(), "an op stays in its session");
+        hub.stop();
+    }
+
+    // Many sessions hosted by peers at once, each found by name, and a name hosted only once.
+    void peersHostSessions(const QString& transport, int sessions)
+    {
+        QScopedPointer<Transport> client_transport(Transport::create(transport));
+        QList<NetworkWorker*> hosts;
+        QList<BenchClient*> clients;
+        bool listening = true;
+        for (int i = 0; i < sessions; ++i)
+        {
+            const QString session = QString("session-%1").arg(i);
+            NetworkWorker* host = new NetworkWorker(session, new JsonSerializer, new JsonDeserializer, Transport::create(transport));
+            listening = host->startHub() && listening;
+            hosts.push_back(host);
+            BenchClient* client = new BenchClient(client_transport.data(), session, session);
+            client->connectToServer();
+            clients.push_back(client);
+        }
+        check(listening, "every session hosted by a peer gets a port of its own");
+        check(allJoined(clients, 10000), "a peer reaches each session by its name");
+
+        NetworkWorker second("session-0", new JsonSerializer, new JsonDeserializer, Transport::create(transport));
+        check(!second.startHub(), "a second peer cannot host a session that is hosted");
+
+        qDeleteAll(clients);
+        for (auto host : hosts)
+        {
+            host->stop();
+        }
+        qDeleteAll(hosts);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("textedit_tcp_test");
+
+    const QString transport = QString("tcp:127.0.0.1:%1").arg(freePort());
+    hubRoutesBySession(transport);
+    peersHostSessions(transport, 50);
+    return g_failures == 0 ? 0 : 1;
+}